@@ -0,0 +1,229 @@
+#include <inc/x86.h>
+
+/**********************************************************************
+ * Disk access for the second boot stage (boot/loader.c).
+ *
+ * disk_init() looks for a PCI IDE controller that can bus-master.  If
+ * there is one, disk_read() hands each READ DMA command a PRD table
+ * describing the destination and lets the controller move the data
+ * while we wait on its status register; otherwise it falls back on the
+ * programmed I/O the boot sector uses, with 256 sectors per command.
+ **********************************************************************/
+
+#define SECTSIZE	512
+#define MAXSECTS	256	// most sectors one ATA command moves
+
+// PCI configuration space, access mechanism #1
+#define PCI_CONF_ADDR	0xCF8
+#define PCI_CONF_DATA	0xCFC
+#define PCI_ID		0x00	// vendor (low) and device (high) ID
+#define PCI_COMMAND	0x04
+#define  PCI_CMD_IO	0x0001	// respond to I/O space accesses
+#define  PCI_CMD_MASTER	0x0004	// may act as bus master
+#define PCI_CLASS	0x08	// class, subclass, prog-if, revision
+#define PCI_HDRTYPE	0x0C	// header type is bits 16-23
+#define PCI_BAR0	0x10
+#define PCI_BAR4	0x20
+
+#define PCI_CLASS_IDE	0x0101	// mass storage, IDE
+#define IDE_PI_NATIVE	0x01	// primary channel in PCI native mode
+#define IDE_PI_MASTER	0x80	// controller can bus-master
+
+// ATA registers, relative to the command block
+#define ATA_DATA	0
+#define ATA_NSECT	2
+#define ATA_LBA0	3
+#define ATA_DEVICE	6
+#define ATA_CMD		7	// command on write, status on read
+#define  ATA_BSY	0x80
+#define  ATA_DRDY	0x40
+#define  ATA_DRQ	0x08
+#define  ATA_ERR	0x01
+#define ATA_CMD_READ	0x20	// READ SECTORS
+#define ATA_CMD_READDMA	0xC8	// READ DMA
+
+// Bus master IDE registers, relative to BAR4, primary channel
+#define BM_CMD		0
+#define  BM_CMD_START	0x01
+#define  BM_CMD_READ	0x08	// transfer to memory
+#define BM_STATUS	2
+#define  BM_ST_ACTIVE	0x01
+#define  BM_ST_ERR	0x02
+#define  BM_ST_INTR	0x04	// device raised its interrupt; write 1 to clear
+#define BM_PRDT		4
+
+// Physical Region Descriptor.  A region may not cross a 64KB boundary,
+// and neither may the table.
+struct Prd {
+	uint32_t prd_addr;
+	uint16_t prd_len;	// 0 means 64KB
+	uint16_t prd_flags;
+};
+#define PRD_EOT		0x8000	// last entry of the table
+
+// One command moves at most 128KB, which touches at most three 64KB
+// windows.
+#define NPRD		3
+
+static struct Prd prdt[NPRD] __attribute__((aligned(32)));
+static int ata_base;		// command block of the primary channel
+static int bm_base;		// its bus master registers, 0 for none
+
+static uint32_t
+pci_read(int bus, int dev, int func, int reg)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | bus << 16 | dev << 11 | func << 8 | reg);
+	return inl(PCI_CONF_DATA);
+}
+
+static void
+pci_write(int bus, int dev, int func, int reg, uint32_t v)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | bus << 16 | dev << 11 | func << 8 | reg);
+	outl(PCI_CONF_DATA, v);
+}
+
+// Set up bus-master DMA through the IDE function at bus/dev/func if it
+// can do it.  Returns 1 if it is usable.
+static int
+ide_attach(int bus, int dev, int func)
+{
+	uint32_t class = pci_read(bus, dev, func, PCI_CLASS);
+	uint32_t bar4;
+
+	if ((class >> 16) != PCI_CLASS_IDE || !(class & (IDE_PI_MASTER << 8)))
+		return 0;
+	bar4 = pci_read(bus, dev, func, PCI_BAR4);
+	if (!(bar4 & 1) || (bar4 & ~3) == 0)
+		return 0;	// not I/O space, or never assigned
+
+	if (class & (IDE_PI_NATIVE << 8))
+		ata_base = pci_read(bus, dev, func, PCI_BAR0) & ~3;
+	bm_base = bar4 & ~3;
+	pci_write(bus, dev, func, PCI_COMMAND,
+		  pci_read(bus, dev, func, PCI_COMMAND)
+		  | PCI_CMD_IO | PCI_CMD_MASTER);
+	return 1;
+}
+
+void
+disk_init(void)
+{
+	int bus, dev, func, nfunc;
+	uint32_t id;
+
+	ata_base = 0x1F0;
+	bm_base = 0;
+	for (bus = 0; bus < 256; bus++)
+		for (dev = 0; dev < 32; dev++) {
+			id = pci_read(bus, dev, 0, PCI_ID);
+			if ((id & 0xFFFF) == 0xFFFF)
+				continue;
+			// bit 7 of the header type: multi-function device
+			nfunc = (pci_read(bus, dev, 0, PCI_HDRTYPE) >> 16) & 0x80
+				? 8 : 1;
+			for (func = 0; func < nfunc; func++) {
+				id = pci_read(bus, dev, func, PCI_ID);
+				if ((id & 0xFFFF) != 0xFFFF &&
+				    ide_attach(bus, dev, func))
+					return;
+			}
+		}
+}
+
+int
+disk_dma(void)
+{
+	return bm_base != 0;
+}
+
+static void
+waitdisk(void)
+{
+	// wait for disk ready
+	while ((inb(ata_base + ATA_CMD) & (ATA_BSY|ATA_DRDY)) != ATA_DRDY)
+		/* do nothing */;
+}
+
+// Start ATA command 'cmd' on 'nsect' sectors (0 means 256) at 'sect'
+static void
+ata_command(uint32_t sect, uint32_t nsect, int cmd)
+{
+	waitdisk();
+	outb(ata_base + ATA_NSECT, nsect);
+	outb(ata_base + ATA_LBA0, sect);
+	outb(ata_base + ATA_LBA0 + 1, sect >> 8);
+	outb(ata_base + ATA_LBA0 + 2, sect >> 16);
+	outb(ata_base + ATA_DEVICE, (sect >> 24) | 0xE0);
+	outb(ata_base + ATA_CMD, cmd);
+}
+
+static void
+pio_read(uint8_t *dst, uint32_t sect, uint32_t nsect)
+{
+	ata_command(sect, nsect, ATA_CMD_READ);
+
+	// the drive raises DRQ once per sector
+	for (; nsect > 0; nsect--, dst += SECTSIZE) {
+		while ((inb(ata_base + ATA_CMD) & (ATA_BSY|ATA_DRQ)) != ATA_DRQ)
+			/* do nothing */;
+		insl(ata_base + ATA_DATA, dst, SECTSIZE/4);
+	}
+}
+
+// Read with one READ DMA command.  Returns 0, or -1 if the controller
+// or the drive reported an error.
+static int
+dma_read(uint8_t *dst, uint32_t sect, uint32_t nsect)
+{
+	uint32_t pa = (uint32_t) dst, end = pa + nsect * SECTSIZE, next;
+	int i, status;
+
+	// Describe the destination, split at 64KB boundaries
+	for (i = 0; pa < end; i++, pa = next) {
+		next = (pa + 0x10000) & ~0xFFFF;
+		if (next > end)
+			next = end;
+		prdt[i].prd_addr = pa;
+		prdt[i].prd_len = next - pa;	// 64KB wraps to 0
+		prdt[i].prd_flags = 0;
+	}
+	prdt[i - 1].prd_flags = PRD_EOT;
+
+	outb(bm_base + BM_CMD, 0);
+	outl(bm_base + BM_PRDT, (uint32_t) prdt);
+	outb(bm_base + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+	outb(bm_base + BM_CMD, BM_CMD_READ);
+
+	ata_command(sect, nsect, ATA_CMD_READDMA);
+	outb(bm_base + BM_CMD, BM_CMD_READ | BM_CMD_START);
+
+	// The controller raises BM_ST_INTR when the drive is done, or
+	// drops BM_ST_ACTIVE early if the PRDs ran out or it failed.
+	do
+		status = inb(bm_base + BM_STATUS);
+	while ((status & (BM_ST_ACTIVE|BM_ST_INTR)) == BM_ST_ACTIVE);
+
+	outb(bm_base + BM_CMD, 0);
+	outb(bm_base + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+	// reading the status register also acknowledges the drive
+	if ((status & BM_ST_ERR) || (inb(ata_base + ATA_CMD) & ATA_ERR))
+		return -1;
+	return 0;
+}
+
+// Read 'nsect' sectors starting at sector 'sect' into physical address 'dst'
+void
+disk_read(void *dst, uint32_t sect, uint32_t nsect)
+{
+	uint32_t n;
+
+	for (; nsect > 0; nsect -= n, sect += n, dst += n * SECTSIZE) {
+		n = nsect < MAXSECTS ? nsect : MAXSECTS;
+		if (bm_base != 0 && dma_read(dst, sect, n) == 0)
+			continue;
+		// no DMA, or it failed: stay with PIO from now on
+		bm_base = 0;
+		pio_read(dst, sect, n);
+	}
+}
@@ -0,0 +1,141 @@
+#include <inc/x86.h>
+#include <inc/elf.h>
+#include <inc/lz4.h>
+#include <inc/mmu.h>
+
+/**********************************************************************
+ * Second boot stage ('make lz4', 'make stage2').
+ *
+ * DISK LAYOUT
+ *  * sector 0 holds the usual boot sector (boot.S and main.c).
+ *
+ *  * sectors 1 to LOADER_NSECT hold this program as an ELF file, so the
+ *    boot sector loads and starts it exactly as it would a kernel.
+ *
+ *  * the sector after that starts the kernel: either a struct Lz4Hdr
+ *    (inc/lz4.h) followed by an LZ4 block with the kernel image, or
+ *    the plain kernel ELF file.
+ *
+ * loadermain() reads the kernel through disk.c, which uses bus-master
+ * DMA when the IDE controller supports it.  A compressed kernel is read
+ * into scratch memory and inflated to lh_pa; a plain ELF kernel has each
+ * segment read straight to its load address, one DMA transfer per 256
+ * sectors.  Either way it then jumps to the kernel's entry point.
+ **********************************************************************/
+
+#define SECTSIZE	512
+#define KERNSECT	(LOADER_NSECT + 1)
+#define SCRATCH		0x400000		// scratch space
+#define LZ4HDR		((struct Lz4Hdr *) SCRATCH)
+#define ELFHDR		((struct Elf *) SCRATCH)
+
+void disk_init(void);
+void disk_read(void*, uint32_t, uint32_t);
+static void readseg(uint32_t, uint32_t, uint32_t);
+static uint32_t lz4_inflate(uint8_t*, const uint8_t*, uint32_t);
+
+void
+loadermain(void)
+{
+	struct Proghdr *ph, *eph;
+	uint32_t nsect;
+
+	disk_init();
+
+	// the first page tells which kind of kernel follows
+	disk_read((void *) SCRATCH, KERNSECT, PGSIZE / SECTSIZE);
+
+	if (ELFHDR->e_magic == ELF_MAGIC) {
+		// load each program segment, file contents only; the
+		// kernel clears its own .bss
+		ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
+		eph = ph + ELFHDR->e_phnum;
+		for (; ph < eph; ph++)
+			if (ph->p_type == ELF_PROG_LOAD)
+				readseg(ph->p_pa, ph->p_filesz, ph->p_offset);
+		((void (*)(void)) (ELFHDR->e_entry))();
+	}
+
+	if (LZ4HDR->lh_magic != LZ4_MAGIC)
+		goto bad;
+	// read the whole payload behind the header
+	nsect = (sizeof(struct Lz4Hdr) + LZ4HDR->lh_csize + SECTSIZE - 1)
+		/ SECTSIZE;
+	disk_read(LZ4HDR, KERNSECT, nsect);
+
+	if (lz4_inflate((uint8_t *) LZ4HDR->lh_pa,
+			(uint8_t *) (LZ4HDR + 1), LZ4HDR->lh_csize)
+	    != LZ4HDR->lh_size)
+		goto bad;
+
+	// call the entry point from the header
+	// note: does not return!
+	((void (*)(void)) (LZ4HDR->lh_entry))();
+
+bad:
+	outw(0x8A00, 0x8A00);
+	outw(0x8A00, 0x8E00);
+	while (1)
+		/* do nothing */;
+}
+
+// Read 'count' bytes at 'offset' from the kernel file into physical
+// address 'pa'.  Might copy more than asked, as the boot sector does.
+static void
+readseg(uint32_t pa, uint32_t count, uint32_t offset)
+{
+	// round down to sector boundary
+	pa -= offset % SECTSIZE;
+	count += offset % SECTSIZE;
+
+	disk_read((void *) pa, KERNSECT + offset / SECTSIZE,
+		  (count + SECTSIZE - 1) / SECTSIZE);
+}
+
+// Copy 'n' bytes forward, one byte after another.  LZ4 matches may
+// overlap their own output, which a forward rep movsb reproduces.
+static void
+copyfwd(uint8_t *dst, const uint8_t *src, uint32_t n)
+{
+	asm volatile("cld; rep movsb"
+		     : "+D" (dst), "+S" (src), "+c" (n)
+		     : : "cc", "memory");
+}
+
+// Inflate the LZ4 block of 'csize' bytes at 'src' into 'dst'.
+// Returns the number of bytes produced.
+static uint32_t
+lz4_inflate(uint8_t *dst, const uint8_t *src, uint32_t csize)
+{
+	const uint8_t *end = src + csize;
+	uint8_t *op = dst;
+	uint32_t token, len, off, b;
+
+	while (src < end) {
+		token = *src++;
+
+		// literals, with 255-byte length extensions
+		if ((len = token >> 4) == 15)
+			do
+				len += (b = *src++);
+			while (b == 255);
+		copyfwd(op, src, len);
+		op += len;
+		src += len;
+
+		// the last sequence has no match
+		if (src >= end)
+			break;
+
+		off = src[0] | (src[1] << 8);
+		src += 2;
+		if ((len = token & 15) == 15)
+			do
+				len += (b = *src++);
+			while (b == 255);
+		len += 4;
+		copyfwd(op, op - off, len);
+		op += len;
+	}
+	return op - dst;
+}
@@ -0,0 +1,108 @@
+#!/usr/bin/perl
+#
+# Build a compressed kernel payload for boot/loader.c.
+#
+# Usage: lz4pack.pl kernel/system kernel/system.lz4
+#
+# The loadable segments of the ELF kernel are laid out as one flat image
+# starting at the lowest p_pa (file-backed bytes only; entry.S clears
+# .bss), compressed as a single LZ4 block and prefixed with the
+# struct Lz4Hdr from inc/lz4.h.
+
+use strict;
+
+my $LZ4_MAGIC = 0x4B345A4C;
+my $ELF_PROG_LOAD = 1;
+
+open(ELF, $ARGV[0]) || die "open $ARGV[0]: $!";
+binmode ELF;
+my $elf = do { local $/; <ELF> };
+close ELF;
+
+my ($magic, $entry, $phoff) = unpack("V x20 V V", $elf);
+my ($phentsize, $phnum) = unpack("x42 v v", $elf);
+die "$ARGV[0]: not an ELF file\n" if $magic != 0x464C457F;
+
+# Collect the file-backed part of every loadable segment.
+my @segs;
+my ($lo, $hi);
+for (my $i = 0; $i < $phnum; $i++) {
+	my ($type, $offset, $va, $pa, $filesz) =
+	    unpack("V5", substr($elf, $phoff + $i * $phentsize, 20));
+	next if $type != $ELF_PROG_LOAD || $filesz == 0;
+	push @segs, [$offset, $pa, $filesz];
+	$lo = $pa if !defined($lo) || $pa < $lo;
+	$hi = $pa + $filesz if !defined($hi) || $pa + $filesz > $hi;
+}
+die "$ARGV[0]: no loadable segments\n" if !@segs;
+
+my $raw = "\0" x ($hi - $lo);
+foreach my $s (@segs) {
+	substr($raw, $s->[1] - $lo, $s->[2]) = substr($elf, $s->[0], $s->[2]);
+}
+
+my $block = compress($raw);
+
+open(OUT, ">$ARGV[1]") || die "open >$ARGV[1]: $!";
+binmode OUT;
+print OUT pack("V5", $LZ4_MAGIC, $entry, $lo, length($raw), length($block));
+print OUT $block;
+close OUT;
+
+printf STDERR "kernel image %d bytes, compressed to %d bytes (%d%%)\n",
+    length($raw), length($block), 100 * length($block) / length($raw);
+
+# Variable-length LZ4 count: 15 in the token, then 255s, then the rest.
+sub lenext {
+	my ($n) = @_;
+	my $s = '';
+	return $s if $n < 15;
+	for ($n -= 15; $n >= 255; $n -= 255) {
+		$s .= chr(255);
+	}
+	return $s . chr($n);
+}
+
+sub sequence {
+	my ($lit, $off, $mlen) = @_;
+	my $llen = length($lit);
+	my $tok = ($llen < 15 ? $llen : 15) << 4;
+	my $s;
+
+	if (!defined $off) {
+		return chr($tok) . lenext($llen) . $lit;
+	}
+	$tok |= ($mlen - 4 < 15 ? $mlen - 4 : 15);
+	$s = chr($tok) . lenext($llen) . $lit . pack("v", $off);
+	return $s . lenext($mlen - 4);
+}
+
+# Greedy LZ4 block compressor.  Matches are found through a table of the
+# last position of every 4-byte string; the format requires the last 5
+# bytes to be literals and the last match to start 12 bytes before the end.
+sub compress {
+	my ($in) = @_;
+	my $n = length($in);
+	my $mflimit = $n - 12;
+	my $matchlimit = $n - 5;
+	my ($i, $anchor) = (0, 0);
+	my %last;
+	my $out = '';
+
+	while ($i < $mflimit) {
+		my $key = substr($in, $i, 4);
+		my $ref = $last{$key};
+		$last{$key} = $i;
+		if (!defined($ref) || $i - $ref > 0xFFFF) {
+			$i++;
+			next;
+		}
+		my $len = 4;
+		$len++ while $i + $len < $matchlimit &&
+		    substr($in, $ref + $len, 1) eq substr($in, $i + $len, 1);
+		$out .= sequence(substr($in, $anchor, $i - $anchor), $i - $ref, $len);
+		$i += $len;
+		$anchor = $i;
+	}
+	return $out . sequence(substr($in, $anchor));
+}
@@ -27,18 +27,23 @@
  *    and a stack so C code then run, then calls bootmain()
  *
  *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
+ *
+ *  * only the p_filesz bytes of each segment are read off the disk; the
+ *    kernel clears the rest of p_memsz (its .bss) itself in entry.S.
  **********************************************************************/
 
 #define SECTSIZE	512
+#define MAXSECTS	256	// most sectors one READ SECTORS command moves
 #define ELFHDR		((struct Elf *) 0x10000) // scratch space
 
-void readsect(void*, uint32_t);
-void readseg(uint32_t, uint32_t, uint32_t);
+static void readsect(void*, uint32_t, uint32_t);
+static void readseg(uint32_t, uint32_t, uint32_t);
 
 void
 bootmain(void)
 {
 	struct Proghdr *ph, *eph;
+	uint32_t pa, end_pa, offset;
 
 	// read 1st page off disk
 	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
@@ -50,28 +55,42 @@ bootmain(void)
 	// load each program segment (ignores ph flags)
 	ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
 	eph = ph + ELFHDR->e_phnum;
-	for (; ph < eph; ph++)
+	pa = end_pa = offset = 0;
+	for (; ph < eph; ph++) {
 		// p_pa is the load address of this segment (as well
-		// as the physical address)
-		readseg(ph->p_pa, ph->p_memsz, ph->p_offset);
+		// as the physical address).  Segments that sit at the
+		// same distance from their file offset and follow each
+		// other closely are merged into one run, so the disk
+		// sees a few long reads instead of one per segment.
+		// Only p_filesz bytes are backed by the image.  The empty
+		// run we start with never merges and reads nothing.
+		if (ph->p_pa - ph->p_offset == pa - offset
+		    && ph->p_pa - end_pa < SECTSIZE*8) {
+			end_pa = ph->p_pa + ph->p_filesz;
+			continue;
+		}
+		readseg(pa, end_pa - pa, offset);
+		pa = ph->p_pa;
+		end_pa = pa + ph->p_filesz;
+		offset = ph->p_offset;
+	}
+	readseg(pa, end_pa - pa, offset);
 
 	// call the entry point from the ELF header
 	// note: does not return!
 	((void (*)(void)) (ELFHDR->e_entry))();
 
 bad:
-	outw(0x8A00, 0x8A00);
-	outw(0x8A00, 0x8E00);
 	while (1)
 		/* do nothing */;
 }
 
 // Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
 // Might copy more than asked
-void
+static void
 readseg(uint32_t pa, uint32_t count, uint32_t offset)
 {
-	uint32_t end_pa;
+	uint32_t end_pa, nsect;
 
 	end_pa = pa + count;
 
@@ -81,21 +100,24 @@ readseg(uint32_t pa, uint32_t count, uint32_t offset)
 	// translate from bytes to sectors, and kernel starts at sector 1
 	offset = (offset / SECTSIZE) + 1;
 
-	// If this is too slow, we could read lots of sectors at a time.
+	// Read up to MAXSECTS sectors per disk command.
 	// We'd write more to memory than asked, but it doesn't matter --
 	// we load in increasing order.
 	while (pa < end_pa) {
+		nsect = (end_pa - pa + SECTSIZE - 1) / SECTSIZE;
+		if (nsect > MAXSECTS)
+			nsect = MAXSECTS;
 		// Since we haven't enabled paging yet and we're using
 		// an identity segment mapping (see boot.S), we can
 		// use physical addresses directly.  This won't be the
 		// case once JOS enables the MMU.
-		readsect((uint8_t*) pa, offset);
-		pa += SECTSIZE;
-		offset++;
+		readsect((uint8_t*) pa, offset, nsect);
+		pa += nsect * SECTSIZE;
+		offset += nsect;
 	}
 }
 
-void
+static void
 waitdisk(void)
 {
 	// wait for disk reaady
@@ -103,23 +125,34 @@ waitdisk(void)
 		/* do nothing */;
 }
 
-void
-readsect(void *dst, uint32_t offset)
+// Read 'nsect' consecutive sectors starting at sector 'offset' into 'dst'
+// with a single READ SECTORS command.
+static void
+readsect(void *dst, uint32_t offset, uint32_t nsect)
 {
+	uint32_t nword;
+
 	// wait for disk to be ready
 	waitdisk();
 
-	outb(0x1F2, 1);		// count = 1
+	outb(0x1F2, nsect);	// count; 0 means 256
 	outb(0x1F3, offset);
 	outb(0x1F4, offset >> 8);
 	outb(0x1F5, offset >> 16);
 	outb(0x1F6, (offset >> 24) | 0xE0);
 	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
 
-	// wait for disk to be ready
-	waitdisk();
-
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+	// the drive raises DRQ once per sector; no new command is needed
+	do {
+		// wait for the next sector's data
+		while ((inb(0x1F7) & 0x88) != 0x08)
+			/* do nothing */;
+
+		// read a sector; rep insl leaves dst just past it
+		nword = SECTSIZE/4;
+		asm volatile("cld; rep insl"
+			     : "+D" (dst), "+c" (nword)
+			     : "d" (0x1F0)
+			     : "memory", "cc");
+	} while (--nsect > 0);
 }
-
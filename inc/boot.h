@@ -0,0 +1,63 @@
+#ifndef JOS_INC_BOOT_H
+#define JOS_INC_BOOT_H
+
+// The boot loader leaves a struct BootInfo at this physical address,
+// just above the boot sector, for the kernel to pick up.
+#define BOOTINFO_ADDR	0x8000
+
+// Boot phases, each timestamped with the TSC as it completes.
+// The boot loader fills in the first two, the kernel the rest.
+#define BT_BOOTSECT	0	// BIOS done, boot sector entered
+#define BT_PROTMODE	1	// switched to protected mode
+#define BT_LOADED	2	// kernel loaded, entry.S reached
+#define BT_VIDEO	3	// init_video()
+#define BT_MEM		4	// mem_init()
+#define BT_PIC		5	// pic_init()
+#define BT_TRAP		6	// trap_init()
+#define BT_DEVICES	7	// kbd_init() and timer_init()
+#define BT_SHELL	8	// first shell prompt
+#define BT_NPHASE	9
+
+// BIOS E820 memory map entry types
+#define E820_RAM	1	// usable
+#define E820_RESERVED	2
+#define E820_ACPI	3	// ACPI tables, reclaimable
+#define E820_NVS	4	// ACPI non-volatile storage
+#define E820_BAD	5	// defective RAM
+
+// The boot sector stores E820 entries without bounds checks; memory up
+// to the ELF scratch page at 0x10000 is free, the kernel reads at most
+// E820_MAX of them.
+#define E820_MAX	128
+
+// Offsets into struct BootInfo, for assembly code
+#define BI_TSC(p)	((p) * 8)
+#define BI_E820END	BI_TSC(BT_NPHASE)
+#define BI_E820		(BI_E820END + 4)
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+struct E820Entry {
+	uint64_t e_addr;
+	uint64_t e_len;
+	uint32_t e_type;	// E820_*
+} __attribute__((packed));
+
+struct BootInfo {
+	uint64_t bi_tsc[BT_NPHASE];	// read_tsc() at the end of each phase
+	uint16_t bi_e820_end;		// address just past the last entry
+	uint16_t bi_padding;
+	struct E820Entry bi_e820[E820_MAX];
+} __attribute__((packed));
+
+// kernel/boottime.c
+void boottime_init(void);
+void boottime_stamp(int phase);
+uint64_t boottime_tsc(int phase);
+const char *boottime_name(int phase);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_BOOT_H */
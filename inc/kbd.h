@@ -1,6 +1,8 @@
 #ifndef KBD_H
 #define KBD_H
 
+#include <inc/types.h>
+
 // Special keycodes
 #define KEY_HOME	0xE0
 #define KEY_END		0xE1
@@ -80,7 +82,26 @@
 #define	KBR_RSTDONE	0xAA	/* reset complete */
 #define	KBR_ECHO	0xEE	/* echo response */
 
+// Modifier state in a key event
+#define KMOD_SHIFT	(1<<0)
+#define KMOD_CTL	(1<<1)
+#define KMOD_ALT	(1<<2)
+#define KMOD_CAPSLOCK	(1<<3)
+#define KMOD_NUMLOCK	(1<<4)
+#define KMOD_SCROLLLOCK	(1<<5)
+
+// A decoded key: the character, the modifiers in effect, and the TSC
+// when the scancode completing it arrived
+struct KbdEvent {
+	uint64_t ke_tsc;
+	uint8_t ke_c;
+	uint8_t ke_mods;
+};
+
 void kbd_init(void);
 void kbd_intr(void);
+int kbd_getevent(struct KbdEvent *ev);
+void kbd_print(void);
+void kbd_reset_stats(void);
 
 #endif 
@@ -0,0 +1,19 @@
+#ifndef JOS_INC_LZ4_H
+#define JOS_INC_LZ4_H
+
+#include <inc/types.h>
+
+#define LZ4_MAGIC	0x4B345A4CU	/* "LZ4K" in little endian */
+
+// A compressed kernel image (see 'make lz4') is a struct Lz4Hdr followed
+// by one LZ4 block holding the kernel's loadable segments as a flat
+// image.  boot/lz4pack.pl builds it, boot/loader.c inflates it.
+struct Lz4Hdr {
+	uint32_t lh_magic;	// must equal LZ4_MAGIC
+	uint32_t lh_entry;	// kernel entry point
+	uint32_t lh_pa;		// physical address the image inflates to
+	uint32_t lh_size;	// inflated size in bytes
+	uint32_t lh_csize;	// compressed size, not counting this header
+};
+
+#endif /* !JOS_INC_LZ4_H */
@@ -12,6 +12,11 @@
 
 #define KSTKSIZE	(8*4096)   		// size of a kernel stack
 
+// The kernel runs at KERNBASE, which maps the first KERNSIZE bytes of
+// physical memory with 4MB pages (see kernel/entry.S).
+#define KERNBASE	0xC0000000
+#define KERNSIZE	0x10000000		// 256MB
+
 // Global descriptor numbers
 #define GD_KT     0x08     // kernel text
 #define GD_KD     0x10     // kernel data
@@ -101,6 +106,7 @@
 #define CR0_PG		0x80000000	// Paging
 
 #define CR4_PCE		0x00000100	// Performance counter enable
+#define CR4_PGE		0x00000080	// Page Global Enable
 #define CR4_MCE		0x00000040	// Machine Check Enable
 #define CR4_PSE		0x00000010	// Page Size Extensions
 #define CR4_DE		0x00000008	// Debugging Extensions
@@ -6,6 +6,18 @@ int mon_help(int argc, char **argv);
 int mon_kerninfo(int argc, char **argv);
 int print_tick(int argc, char **argv);
 int chgcolor(int argc, char **argv);
+int mon_boottime(int argc, char **argv);
+int mon_meminfo(int argc, char **argv);
+int mon_restart(int argc, char **argv);
+int mon_traplat(int argc, char **argv);
+int mon_irqstat(int argc, char **argv);
+int mon_tickless(int argc, char **argv);
+int mon_clock(int argc, char **argv);
+int mon_timers(int argc, char **argv);
+int mon_syscall(int argc, char **argv);
+int mon_kbdstat(int argc, char **argv);
+int mon_vgastat(int argc, char **argv);
+int mon_printbench(int argc, char **argv);
 void settextcolor(unsigned char forecolor, unsigned char backcolor);
 
 #endif
@@ -2,6 +2,7 @@
 #define JOS_INC_STDIO_H
 
 #include <inc/stdarg.h>
+#include <inc/types.h>
 
 #ifndef NULL
 #define NULL	((void *) 0)
@@ -13,6 +14,9 @@ int	getc(void);
 //lib/screen.c
 void	putch(unsigned char c);
 void	puts(unsigned char *text);
+void	console_write(const char *buf, size_t len);
+void	screen_flush(void);
+void	screen_print_stats(void);
 
 // lib/printfmt.c
 void	printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
@@ -23,6 +27,7 @@ int	vsnprintf(char *str, int size, const char *fmt, va_list);
 // lib/printf.c
 int	cprintf(const char *fmt, ...);
 int	vcprintf(const char *fmt, va_list);
+void	cprintf_bench(int n);
 
 // lib/readline.c
 char *readline(const char *prompt);
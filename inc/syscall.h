@@ -0,0 +1,15 @@
+#ifndef JOS_INC_SYSCALL_H
+#define JOS_INC_SYSCALL_H
+
+/*
+ * System call numbers.  The number goes in %eax.  With int $T_SYSCALL
+ * the arguments go in %edx, %ecx, %ebx, %edi and %esi; with SYSENTER
+ * the first four do, and %esi and %ebp hold the address and stack
+ * pointer to return to.  The result comes back in %eax.
+ */
+#define SYS_null	0	// do nothing; for measuring entry cost
+#define SYS_exit	1	// leave user mode, handing back a1
+#define SYS_gettick	2	// timer ticks since boot
+#define NSYSCALLS	3
+
+#endif /* !JOS_INC_SYSCALL_H */
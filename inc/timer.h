@@ -1,6 +1,23 @@
 #ifndef TIMER_H
 #define TIMER_H
+
+#include <inc/types.h>
+
+#define TIME_HZ		100		/* timer ticks per second */
+#define PIT_HZ		1193180		/* PIT input clock */
+
 void timer_init();
-void timer_handler();
+struct Trapframe;
+void timer_handler(struct Trapframe *tf, void *arg);
 unsigned long get_tick();
+void timer_idle();
+void timer_dynticks(int on);
+void timer_print_idle();
+
+/* kernel/clock.c */
+void clock_init();
+unsigned long tsc_khz();
+uint64_t get_time_cycles();
+uint64_t get_time_ns();
+void clock_print();
 #endif
@@ -0,0 +1,400 @@
+/*
+ * Local APIC and I/O APIC.
+ *
+ * apic_init() looks for the interrupt controllers in the ACPI MADT and
+ * then in the Intel MultiProcessor tables.  It enables the local APIC
+ * of this CPU and masks every I/O APIC pin; kernel/irq.c routes the
+ * IRQs it enables with ioapic_route().  Only the first I/O APIC is used.
+ *
+ * The APIC registers live in uncached memory that mmio_map() maps 1:1
+ * above the kernel, so acknowledging an interrupt is a single store to
+ * LAPIC_EOI.
+ */
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/trap.h>
+#include <inc/x86.h>
+#include <kernel/apic.h>
+#include <kernel/pmap.h>
+
+#define CPUID_APIC	(1 << 9)	// CPUID.1:EDX, on-chip APIC
+
+// ACPI Root System Description Pointer
+struct Rsdp {
+	char rsdp_sig[8];		// "RSD PTR "
+	uint8_t rsdp_checksum;		// of the first 20 bytes
+	char rsdp_oemid[6];
+	uint8_t rsdp_rev;
+	uint32_t rsdp_rsdt;
+} __attribute__((packed));
+
+// Header of every ACPI system description table
+struct AcpiHdr {
+	char ah_sig[4];
+	uint32_t ah_len;		// including the header
+	uint8_t ah_rev;
+	uint8_t ah_checksum;
+	char ah_oemid[6];
+	char ah_oemtable[8];
+	uint32_t ah_oemrev;
+	uint32_t ah_creator;
+	uint32_t ah_creatorrev;
+} __attribute__((packed));
+
+// Multiple APIC Description Table ("APIC"), followed by its entries
+struct Madt {
+	struct AcpiHdr madt_hdr;
+	uint32_t madt_lapic;		// local APIC address
+	uint32_t madt_flags;
+} __attribute__((packed));
+
+#define MADT_IOAPIC	1	// I/O APIC: id, 0, address, GSI base
+#define MADT_OVERRIDE	2	// interrupt source override
+
+// MP floating pointer structure ("_MP_")
+struct MpFloat {
+	char mp_sig[4];
+	uint32_t mp_conf;		// physical address of the MpConf
+	uint8_t mp_len;			// in 16-byte units
+	uint8_t mp_rev;
+	uint8_t mp_checksum;
+	uint8_t mp_type;		// default configuration, if nonzero
+	uint8_t mp_imcrp;		// bit 7: IMCR present
+	uint8_t mp_reserved[3];
+} __attribute__((packed));
+
+// MP configuration table header ("PCMP"), followed by its entries
+struct MpConf {
+	char mpc_sig[4];
+	uint16_t mpc_len;		// including the header
+	uint8_t mpc_rev;
+	uint8_t mpc_checksum;
+	char mpc_product[20];
+	uint32_t mpc_oemtable;
+	uint16_t mpc_oemlen;
+	uint16_t mpc_nentry;
+	uint32_t mpc_lapic;		// local APIC address
+	uint16_t mpc_xlen;
+	uint8_t mpc_xchecksum;
+	uint8_t mpc_reserved;
+} __attribute__((packed));
+
+#define MPPROC		0x00	// one per processor, 20 bytes
+#define MPBUS		0x01	// one per bus, the others are 8 bytes
+#define MPIOAPIC	0x02	// one per I/O APIC
+#define MPIOINTR	0x03	// one per bus interrupt source
+#define MPLINTR		0x04	// one per system interrupt source
+
+// Polarity and trigger mode bits of MADT overrides and MP interrupt
+// entries; 0 means whatever the bus does, high and edge for ISA
+#define INTI_POLARITY(f)	((f) & 3)
+#define INTI_TRIGGER(f)		(((f) >> 2) & 3)
+#define  INTI_HIGH_EDGE		1
+#define  INTI_LOW_LEVEL		3
+
+volatile uint32_t *lapic;
+static volatile uint32_t *ioapic;
+static physaddr_t lapic_pa, ioapic_pa;
+static bool imcr;		// must switch the IMCR over to the APIC
+static int npins;		// I/O APIC redirection entries
+static const char *source;	// where we found all this
+
+// ISA IRQs may arrive on another pin and with another polarity or
+// trigger mode than the bus default
+static uint8_t isa_pin[16];
+static uint32_t isa_mode[16];
+
+static void
+lapicw(int reg, uint32_t v)
+{
+	lapic[reg / 4] = v;
+	lapic[LAPIC_ID / 4];	// wait for the write to finish
+}
+
+static uint32_t
+ioapic_read(int reg)
+{
+	ioapic[IOAPIC_REGSEL / 4] = reg;
+	return ioapic[IOAPIC_WIN / 4];
+}
+
+static void
+ioapic_write(int reg, uint32_t v)
+{
+	ioapic[IOAPIC_REGSEL / 4] = reg;
+	ioapic[IOAPIC_WIN / 4] = v;
+}
+
+static uint8_t
+sum(const void *addr, size_t len)
+{
+	const uint8_t *p = addr;
+	uint8_t s = 0;
+
+	while (len-- > 0)
+		s += *p++;
+	return s;
+}
+
+// Kernel address of the physical range [pa, pa + len), if it is mapped
+static void *
+phys(physaddr_t pa, size_t len)
+{
+	if (pa + len > KERNSIZE || pa + len < pa)
+		return NULL;
+	return KADDR(pa);
+}
+
+// Look for 'sig' on a 16-byte boundary in [pa, pa + len), in a structure
+// whose first 'cklen' bytes sum to zero
+static void *
+scan(physaddr_t pa, size_t len, const char *sig, size_t cklen)
+{
+	uint8_t *p, *e;
+
+	if ((p = phys(pa, len)) == NULL)
+		return NULL;
+	for (e = p + len; p + cklen <= e; p += 16)
+		if (memcmp(p, sig, strlen(sig)) == 0 && sum(p, cklen) == 0)
+			return p;
+	return NULL;
+}
+
+// Search the places the specs allow: the first KB of the EBDA, the last
+// KB of base memory, and the BIOS ROM from 'rom' to 1MB.
+static void *
+search(const char *sig, size_t cklen, physaddr_t rom)
+{
+	uint16_t ebda = *(uint16_t *) KADDR(0x40E);	// segment
+	uint16_t basekb = *(uint16_t *) KADDR(0x413);
+	void *p;
+
+	if (ebda && (p = scan(ebda << 4, 1024, sig, cklen)))
+		return p;
+	if ((p = scan(basekb * 1024 - 1024, 1024, sig, cklen)))
+		return p;
+	return scan(rom, 0x100000 - rom, sig, cklen);
+}
+
+static void
+isa_override(int irq, int pin, int flags)
+{
+	if (irq >= 16)
+		return;
+	isa_pin[irq] = pin;
+	isa_mode[irq] = 0;
+	if (INTI_POLARITY(flags) == INTI_LOW_LEVEL)
+		isa_mode[irq] |= IOAPIC_ACTLOW;
+	if (INTI_TRIGGER(flags) == INTI_LOW_LEVEL)
+		isa_mode[irq] |= IOAPIC_LEVEL;
+}
+
+static int
+madt_probe(void)
+{
+	struct Rsdp *rsdp;
+	struct AcpiHdr *rsdt, *h;
+	struct Madt *madt = NULL;
+	uint32_t *ent;
+	uint8_t *p, *e;
+	int i, n;
+
+	if (!(rsdp = search("RSD PTR ", 20, 0xE0000)))
+		return -1;
+	if (!(rsdt = phys(rsdp->rsdp_rsdt, sizeof(*rsdt))) ||
+	    !phys(rsdp->rsdp_rsdt, rsdt->ah_len) ||
+	    sum(rsdt, rsdt->ah_len) != 0)
+		return -1;
+
+	ent = (uint32_t *) (rsdt + 1);
+	n = (rsdt->ah_len - sizeof(*rsdt)) / 4;
+	for (i = 0; i < n && !madt; i++)
+		if ((h = phys(ent[i], sizeof(*h))) &&
+		    memcmp(h->ah_sig, "APIC", 4) == 0 &&
+		    phys(ent[i], h->ah_len) && sum(h, h->ah_len) == 0)
+			madt = (struct Madt *) h;
+	if (!madt)
+		return -1;
+
+	lapic_pa = madt->madt_lapic;
+	p = (uint8_t *) (madt + 1);
+	e = (uint8_t *) madt + madt->madt_hdr.ah_len;
+	for (; p + 2 <= e && p[1] >= 2; p += p[1]) {
+		// the first I/O APIC, if it takes GSI 0 up
+		if (p[0] == MADT_IOAPIC && !ioapic_pa &&
+		    *(uint32_t *) (p + 8) == 0)
+			ioapic_pa = *(uint32_t *) (p + 4);
+		// bus 0 is ISA
+		if (p[0] == MADT_OVERRIDE && p[2] == 0)
+			isa_override(p[3], *(uint32_t *) (p + 4),
+				     *(uint16_t *) (p + 8));
+	}
+	source = "ACPI MADT";
+	return ioapic_pa ? 0 : -1;
+}
+
+static int
+mp_probe(void)
+{
+	struct MpFloat *mp;
+	struct MpConf *conf;
+	uint8_t *p, *e;
+	int i, isabus = -1;
+
+	if (!(mp = search("_MP_", 16, 0xF0000)) || mp->mp_conf == 0)
+		return -1;
+	if (!(conf = phys(mp->mp_conf, sizeof(*conf))) ||
+	    memcmp(conf->mpc_sig, "PCMP", 4) != 0 ||
+	    !phys(mp->mp_conf, conf->mpc_len) ||
+	    sum(conf, conf->mpc_len) != 0)
+		return -1;
+
+	lapic_pa = conf->mpc_lapic;
+	imcr = mp->mp_imcrp & 0x80;
+	p = (uint8_t *) (conf + 1);
+	e = (uint8_t *) conf + conf->mpc_len;
+	for (i = 0; i < conf->mpc_nentry && p < e; i++) {
+		switch (p[0]) {
+		case MPPROC:
+			p += 20;
+			continue;
+		case MPBUS:
+			if (memcmp(p + 2, "ISA", 3) == 0)
+				isabus = p[1];
+			break;
+		case MPIOAPIC:
+			// p[3] bit 0: usable
+			if (!ioapic_pa && (p[3] & 1))
+				ioapic_pa = *(uint32_t *) (p + 4);
+			break;
+		case MPIOINTR:
+			// only vectored interrupts (type 0) from ISA
+			if (p[1] == 0 && p[4] == isabus)
+				isa_override(p[5], p[7], *(uint16_t *) (p + 2));
+			break;
+		case MPLINTR:
+			break;
+		default:
+			return -1;	// unknown entry, length unknown
+		}
+		p += 8;
+	}
+	source = "MP table";
+	return ioapic_pa ? 0 : -1;
+}
+
+/*
+ * Find and set up the APICs.
+ * Returns the number of IRQ inputs of the I/O APIC, or 0 if there is no
+ * usable APIC and the 8259A has to do.
+ */
+int
+apic_init(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+	int i;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & CPUID_APIC))
+		return 0;
+
+	for (i = 0; i < 16; i++)
+		isa_override(i, i, 0);
+	if (madt_probe() < 0) {
+		for (i = 0; i < 16; i++)
+			isa_override(i, i, 0);
+		lapic_pa = ioapic_pa = 0;
+		if (mp_probe() < 0)
+			return 0;
+	}
+	if (!(lapic = mmio_map(lapic_pa, PGSIZE)) ||
+	    !(ioapic = mmio_map(ioapic_pa, PGSIZE))) {
+		lapic = NULL;
+		return 0;
+	}
+
+	// Route the interrupts around the 8259A, if the board can
+	if (imcr) {
+		outb(0x22, 0x70);
+		outb(0x23, inb(0x23) | 1);
+	}
+
+	// Enable the local APIC, with the ERROR interrupt but none of the
+	// others; devices come in through the I/O APIC
+	lapicw(LAPIC_SVR, LAPIC_ENABLE | APIC_SPURIOUS);
+	lapicw(LAPIC_TIMER, LAPIC_MASKED);
+	lapicw(LAPIC_LINT0, LAPIC_MASKED);
+	lapicw(LAPIC_LINT1, LAPIC_MASKED);
+	if (((lapic[LAPIC_VER / 4] >> 16) & 0xFF) >= 4)
+		lapicw(LAPIC_PCINT, LAPIC_MASKED);
+	lapicw(LAPIC_ERROR, IRQ_OFFSET + IRQ_ERROR);
+	lapicw(LAPIC_ESR, 0);
+	lapicw(LAPIC_ESR, 0);
+	lapicw(LAPIC_EOI, 0);
+	lapicw(LAPIC_TPR, 0);
+
+	npins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+	for (i = 0; i < npins; i++) {
+		ioapic_write(IOAPIC_TABLE + 2 * i, IOAPIC_MASKED);
+		ioapic_write(IOAPIC_TABLE + 2 * i + 1, 0);
+	}
+	return npins;
+}
+
+// Deliver IRQ 'irq' to this CPU as 'vector', or mask it
+void
+ioapic_route(int irq, int vector, bool enable)
+{
+	int pin = irq < 16 ? isa_pin[irq] : irq;
+	uint32_t mode = irq < 16 ? isa_mode[irq]
+		: IOAPIC_LEVEL | IOAPIC_ACTLOW;	// PCI
+
+	if (!ioapic || pin >= npins)
+		return;
+	ioapic_write(IOAPIC_TABLE + 2 * pin + 1, (lapic[LAPIC_ID / 4] >> 24) << 24);
+	ioapic_write(IOAPIC_TABLE + 2 * pin,
+		     vector | mode | (enable ? 0 : IOAPIC_MASKED));
+}
+
+void
+lapic_eoi(void)
+{
+	lapic[LAPIC_EOI / 4] = 0;
+}
+
+// Quiet everything for a warm restart: mask the pins and acknowledge
+// whatever is still in service, or the LAPIC would hold off those
+// vectors after the restart
+void
+apic_shutdown(void)
+{
+	int i, n;
+
+	if (!lapic)
+		return;
+	for (i = 0; i < npins; i++)
+		ioapic_write(IOAPIC_TABLE + 2 * i, IOAPIC_MASKED);
+	for (n = 0; n < 256; n++) {
+		for (i = 0; i < 8; i++)
+			if (lapic[(LAPIC_ISR + 0x10 * i) / 4])
+				break;
+		if (i == 8)
+			break;
+		lapic_eoi();
+	}
+	lapicw(LAPIC_ERROR, LAPIC_MASKED);
+}
+
+void
+apic_print(void)
+{
+	int i;
+
+	cprintf("Local APIC %d at 0x%08x, I/O APIC at 0x%08x with %d pins (%s)\n",
+		lapic[LAPIC_ID / 4] >> 24, lapic_pa, ioapic_pa, npins, source);
+	for (i = 0; i < 16; i++)
+		if (isa_pin[i] != i || isa_mode[i])
+			cprintf("  ISA IRQ %d on pin %d%s%s\n", i, isa_pin[i],
+				isa_mode[i] & IOAPIC_ACTLOW ? ", active low" : "",
+				isa_mode[i] & IOAPIC_LEVEL ? ", level" : "");
+}
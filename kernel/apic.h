@@ -0,0 +1,49 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_APIC_H
+#define JOS_KERN_APIC_H
+
+#include <inc/types.h>
+
+// Local APIC registers, as byte offsets
+#define LAPIC_ID	0x020	// ID
+#define LAPIC_VER	0x030	// Version
+#define LAPIC_TPR	0x080	// Task Priority
+#define LAPIC_EOI	0x0B0	// EOI
+#define LAPIC_SVR	0x0F0	// Spurious Interrupt Vector
+#define  LAPIC_ENABLE	0x00000100	// Unit Enable
+#define LAPIC_ISR	0x100	// In-Service, 8 registers 0x10 apart
+#define LAPIC_ESR	0x280	// Error Status
+#define LAPIC_TIMER	0x320	// Local Vector Table 0 (TIMER)
+#define  LAPIC_ONESHOT	0x00000000	// Timer fires once
+#define  LAPIC_PERIODIC	0x00020000	// Timer reloads
+#define LAPIC_PCINT	0x340	// Performance Counter LVT
+#define LAPIC_LINT0	0x350	// Local Vector Table 1 (LINT0)
+#define LAPIC_LINT1	0x360	// Local Vector Table 2 (LINT1)
+#define LAPIC_ERROR	0x370	// Local Vector Table 3 (ERROR)
+#define  LAPIC_MASKED	0x00010000	// Interrupt masked
+#define LAPIC_TICR	0x380	// Timer Initial Count
+#define LAPIC_TCCR	0x390	// Timer Current Count
+#define LAPIC_TDCR	0x3E0	// Timer Divide Configuration
+#define  LAPIC_X1	0x0000000B	// divide counts by 1
+
+// I/O APIC registers, through the index/data window
+#define IOAPIC_REGSEL	0x00	// register index (byte offset)
+#define IOAPIC_WIN	0x10	// register data (byte offset)
+#define IOAPIC_VER	0x01	// version; max redirection entry in 16-23
+#define IOAPIC_TABLE	0x10	// redirection table, two registers per pin
+#define  IOAPIC_MASKED	0x00010000	// interrupt disabled
+#define  IOAPIC_LEVEL	0x00008000	// level-triggered (vs edge)
+#define  IOAPIC_ACTLOW	0x00002000	// active low (vs high)
+
+#define APIC_SPURIOUS	0xFF	// vector of LAPIC spurious interrupts
+
+extern volatile uint32_t *lapic;	// NULL until apic_init() finds one
+
+int apic_init(void);
+void ioapic_route(int irq, int vector, bool enable);
+void lapic_eoi(void);
+void apic_shutdown(void);
+void apic_print(void);
+
+#endif /* !JOS_KERN_APIC_H */
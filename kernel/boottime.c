@@ -0,0 +1,46 @@
+/*
+ * Boot phase timing.  boot.S and entry.S stamp the early phases into the
+ * struct BootInfo at BOOTINFO_ADDR; boottime_init() copies them and the
+ * kernel stamps the rest of the phases (see inc/boot.h) as it goes.
+ */
+#include <inc/boot.h>
+#include <inc/x86.h>
+#include <kernel/pmap.h>
+
+static uint64_t boot_tsc[BT_NPHASE];
+
+static const char * const phasenames[BT_NPHASE] = {
+	[BT_BOOTSECT]	= "BIOS, reset to boot sector",
+	[BT_PROTMODE]	= "boot.S E820, protected mode",
+	[BT_LOADED]	= "bootmain kernel load",
+	[BT_VIDEO]	= "init_video",
+	[BT_MEM]	= "mem_init",
+	[BT_PIC]	= "irq_init",
+	[BT_TRAP]	= "trap_init",
+	[BT_DEVICES]	= "kbd/timer/clock_init",
+	[BT_SHELL]	= "first shell prompt",
+};
+
+void boottime_init(void)
+{
+	struct BootInfo *bi = (struct BootInfo *) KADDR(BOOTINFO_ADDR);
+	int i;
+
+	for (i = BT_BOOTSECT; i <= BT_LOADED; i++)
+		boot_tsc[i] = bi->bi_tsc[i];
+}
+
+void boottime_stamp(int phase)
+{
+	boot_tsc[phase] = read_tsc();
+}
+
+uint64_t boottime_tsc(int phase)
+{
+	return boot_tsc[phase];
+}
+
+const char *boottime_name(int phase)
+{
+	return phasenames[phase];
+}
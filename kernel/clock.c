@@ -0,0 +1,104 @@
+/*
+ * TSC clocksource.
+ *
+ * clock_init() measures the TSC rate against PIT channel 2, which runs
+ * off the same 1.193182MHz crystal as the tick but needs no interrupts,
+ * and derives the mult/shift pair get_time_ns() converts cycles with:
+ *
+ *	ns = cycles * clock_mult >> clock_shift
+ *
+ * done as two 32x32->64 bit multiplies, so reading the time never
+ * divides.  Both clocks count from clock_init().
+ */
+#include <inc/stdio.h>
+#include <inc/timer.h>
+#include <inc/x86.h>
+
+#define CAL_MS		10	/* length of one calibration run */
+#define CAL_RUNS	3	/* keep the shortest, in case of SMIs */
+#define CAL_LATCH	(PIT_HZ * CAL_MS / 1000)
+
+static uint64_t clock_base;		/* TSC at clock_init() */
+static unsigned long clock_khz;
+static uint32_t clock_mult;
+static int clock_shift;
+static unsigned long clock_jiffies;	/* get_tick() at clock_init() */
+
+/* TSC cycles for CAL_LATCH counts of PIT channel 2 */
+static uint64_t calibrate()
+{
+	uint64_t t0;
+
+	/* gate channel 2 on, speaker off */
+	outb(0x61, (inb(0x61) & ~0x02) | 0x01);
+	outb(0x43, 0xB0);		/* channel 2, mode 0, lo/hi byte */
+	outb(0x42, CAL_LATCH & 0xFF);
+	outb(0x42, CAL_LATCH >> 8);
+	t0 = read_tsc();
+	/* OUT2 shows in bit 5 of port 0x61; it rises at terminal count */
+	while (!(inb(0x61) & 0x20))
+		/* do nothing */;
+	return read_tsc() - t0;
+}
+
+/* (c * mult) >> shift, for shift <= 32 */
+static uint64_t mul_shr(uint64_t c, uint32_t mult, int shift)
+{
+	uint64_t lo = (uint64_t) (uint32_t) c * mult;
+	uint64_t hi = (c >> 32) * mult;
+
+	return (lo >> shift) + (hi << (32 - shift));
+}
+
+void clock_init()
+{
+	uint64_t c, best = ~0ULL;
+	int i;
+
+	for (i = 0; i < CAL_RUNS; i++)
+		if ((c = calibrate()) < best)
+			best = c;
+	clock_khz = best * PIT_HZ / (CAL_LATCH * 1000ULL);
+	if (clock_khz == 0)
+		clock_khz = 1;
+
+	/* The most precise shift whose multiplier still fits 32 bits */
+	for (clock_shift = 32; clock_shift > 0; clock_shift--)
+		if ((1000000ULL << clock_shift) / clock_khz <= 0xFFFFFFFF)
+			break;
+	clock_mult = (1000000ULL << clock_shift) / clock_khz;
+
+	clock_base = read_tsc();
+	clock_jiffies = get_tick();
+}
+
+unsigned long tsc_khz()
+{
+	return clock_khz;
+}
+
+uint64_t get_time_cycles()
+{
+	return read_tsc() - clock_base;
+}
+
+uint64_t get_time_ns()
+{
+	return mul_shr(get_time_cycles(), clock_mult, clock_shift);
+}
+
+void clock_print()
+{
+	uint64_t ns = get_time_ns();
+	uint64_t jns = (uint64_t) (get_tick() - clock_jiffies)
+		* (1000000000 / TIME_HZ);
+	int64_t drift = ns - jns;
+
+	cprintf("TSC %lu kHz, calibrated against PIT channel 2\n", clock_khz);
+	cprintf("ns = cycles * %u >> %d\n", clock_mult, clock_shift);
+	cprintf("Uptime %llu ns by the TSC, %llu ns by jiffies\n", ns, jns);
+	if (jns)
+		cprintf("TSC - jiffies: %lld ns, %lld ppm (ticks are %d ns)\n",
+			drift, drift * 1000000 / (int64_t) jns,
+			1000000000 / TIME_HZ);
+}
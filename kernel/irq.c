@@ -0,0 +1,208 @@
+/*
+ * Interrupt controller front end.
+ *
+ * Drivers enable and disable IRQ lines here and trap_dispatch()
+ * acknowledges them through irq_eoi(), whichever controller is doing
+ * the work: the local and I/O APICs when apic_init() finds them, or
+ * else the 8259A pair in kernel/picirq.c.
+ *
+ * The 8259A is disabled lazily.  irq_disable() only clears the IRQ's
+ * bit in irq_on; the line is masked if and when the IRQ then arrives,
+ * and irq_enable() replays it.  An IRQ that stays quiet while disabled
+ * costs no mask register writes at all.
+ */
+#include <inc/stdio.h>
+#include <inc/error.h>
+#include <kernel/apic.h>
+#include <kernel/irq.h>
+#include <kernel/picirq.h>
+#include <kernel/trap.h>
+
+static bool use_apic;
+static int nirqs;
+static uint8_t irq_vector[MAX_APIC_IRQS];
+static uint32_t irq_on;			// enabled IRQs, a bit each
+static bool vector_eoi[256];		// vectors that need an EOI
+static uint32_t irq_pending;		// arrived while disabled, 8259A only
+static uint32_t lazy_disables, lazy_masks;
+
+void
+irq_init(void)
+{
+	int i;
+
+	// The 8259A gets remapped and masked even if the APIC takes
+	// over, so nothing it raises lands on an exception vector
+	pic_init();
+
+	nirqs = apic_init();
+	use_apic = nirqs > 0;
+	if (nirqs > MAX_APIC_IRQS)
+		nirqs = MAX_APIC_IRQS;
+	if (!use_apic)
+		nirqs = MAX_IRQS;
+
+	for (i = 0; i < nirqs; i++) {
+		irq_vector[i] = IRQ_VECTOR(i);
+		vector_eoi[irq_vector[i]] = 1;
+	}
+	if (use_apic) {
+		vector_eoi[IRQ_OFFSET + IRQ_ERROR] = 1;
+		irq_setvector(IRQ_TIMER, IRQ_TIMER_VECTOR);
+	}
+}
+
+void
+irq_enable(int irq)
+{
+	uint32_t eflags = read_eflags();
+	bool resend;
+
+	if (irq < 0 || irq >= nirqs)
+		return;
+	__asm __volatile("cli");
+	irq_on |= 1 << irq;
+	if (use_apic)
+		ioapic_route(irq, irq_vector[irq], 1);
+	else if (irq_mask_8259A & (1 << irq))
+		irq_setmask_8259A(irq_mask_8259A & ~(1 << irq));
+	resend = irq_pending & (1 << irq);
+	irq_pending &= ~(1 << irq);
+	write_eflags(eflags);
+
+	// The 8259A has forgotten an IRQ it raised while masked
+	if (resend)
+		trap_resend(irq_vector[irq]);
+}
+
+void
+irq_disable(int irq)
+{
+	if (irq < 0 || irq >= nirqs)
+		return;
+	irq_on &= ~(1 << irq);
+	if (use_apic)
+		ioapic_route(irq, irq_vector[irq], 0);
+	else
+		lazy_disables++;
+}
+
+/*
+ * Deliver 'irq' on 'vector' instead.  The local APIC ranks interrupts
+ * by vector / 16, so this also sets the IRQ's priority.  Only the APIC
+ * can do this; the 8259A's vectors are fixed at IRQ_OFFSET + irq.
+ * The new vector must be free, and nothing may be registered on the
+ * old one yet, as its handlers would stay behind: call this before
+ * trap_register(irq_to_vector(irq), ...).
+ * Returns 0 or -E_INVAL.
+ */
+int
+irq_setvector(int irq, int vector)
+{
+	if (!use_apic || irq < 0 || irq >= nirqs ||
+	    vector < IRQ_OFFSET || vector >= APIC_SPURIOUS ||
+	    vector == T_SYSCALL)
+		return -E_INVAL;
+	if (vector == irq_vector[irq])
+		return 0;
+	// another IRQ, or the local APIC's error interrupt, has it
+	if (vector_eoi[vector] || trap_has_handlers(irq_vector[irq]))
+		return -E_INVAL;
+	vector_eoi[irq_vector[irq]] = 0;
+	irq_vector[irq] = vector;
+	vector_eoi[vector] = 1;
+	ioapic_route(irq, vector, irq_on & (1 << irq));
+	return 0;
+}
+
+// The vector 'irq' is delivered on, for trap_register()
+int
+irq_to_vector(int irq)
+{
+	if (irq < 0 || irq >= nirqs)
+		return -E_INVAL;
+	return irq_vector[irq];
+}
+
+// Whether vector 'trapno' is a device IRQ, whose handlers may be
+// preempted by higher-priority ones until irq_eoi()
+bool
+irq_is_device(int trapno)
+{
+	trapno &= 0xFF;
+	return vector_eoi[trapno] &&
+		!(use_apic && trapno == IRQ_OFFSET + IRQ_ERROR);
+}
+
+// Whether vector 'trapno' is a spurious interrupt, to be dropped
+// without running its handlers or sending an EOI
+bool
+irq_spurious(int trapno)
+{
+	if (use_apic)
+		return trapno == APIC_SPURIOUS;
+	if (trapno == IRQ_OFFSET + 7 || trapno == IRQ_OFFSET + 15)
+		return pic_spurious(trapno - IRQ_OFFSET);
+	return 0;
+}
+
+/*
+ * Whether vector 'trapno' is an 8259A IRQ that irq_disable() turned
+ * off but left unmasked.  If so, mask it now, retire it, and leave it
+ * pending for irq_enable().
+ */
+bool
+irq_lazy_disabled(int trapno)
+{
+	int irq = trapno - IRQ_OFFSET;
+
+	if (use_apic || irq < 0 || irq >= MAX_IRQS || (irq_on & (1 << irq)))
+		return 0;
+	irq_setmask_8259A(irq_mask_8259A | (1 << irq));
+	irq_pending |= 1 << irq;
+	lazy_masks++;
+	pic_eoi(irq);
+	return 1;
+}
+
+// Acknowledge the interrupt that came in on vector 'trapno', if that
+// is an interrupt that needs it
+void
+irq_eoi(int trapno)
+{
+	if (!vector_eoi[trapno & 0xFF])
+		return;
+	if (use_apic)
+		lapic_eoi();
+	else
+		pic_eoi(trapno - IRQ_OFFSET);
+}
+
+// Mask every IRQ and retire the ones in service, for a warm restart
+void
+irq_shutdown(void)
+{
+	outb(IO_PIC1+1, 0xFF);
+	outb(IO_PIC2+1, 0xFF);
+	outb(IO_PIC2, 0x20);
+	outb(IO_PIC1, 0x20);
+	if (use_apic)
+		apic_shutdown();
+}
+
+void
+irq_print(void)
+{
+	int i;
+
+	if (use_apic)
+		apic_print();
+	else {
+		pic_print();
+		cprintf("  lazy disables %u, masked on arrival %u\n",
+			lazy_disables, lazy_masks);
+	}
+	for (i = 0; i < nirqs; i++)
+		if (irq_on & (1 << i))
+			cprintf("  IRQ %d enabled on vector %d\n", i, irq_vector[i]);
+}
@@ -0,0 +1,32 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_IRQ_H
+#define JOS_KERN_IRQ_H
+
+#include <inc/trap.h>
+
+// Only the I/O APIC has IRQs from 16 up; their vectors start here, clear
+// of T_SYSCALL
+#define IRQ_OFFSET_HI	64
+#define MAX_APIC_IRQS	24
+
+#define IRQ_VECTOR(irq)	\
+	((irq) < 16 ? IRQ_OFFSET + (irq) : IRQ_OFFSET_HI + (irq) - 16)
+
+// With the APIC the timer gets the top priority class to itself, so
+// it preempts every other IRQ as IRQ 0 does on the 8259A
+#define IRQ_TIMER_VECTOR	0xF0
+
+void irq_init(void);
+void irq_enable(int irq);
+void irq_disable(int irq);
+int irq_setvector(int irq, int vector);
+int irq_to_vector(int irq);
+bool irq_is_device(int trapno);
+bool irq_spurious(int trapno);
+bool irq_lazy_disabled(int trapno);
+void irq_eoi(int trapno);
+void irq_shutdown(void);
+void irq_print(void);
+
+#endif /* !JOS_KERN_IRQ_H */
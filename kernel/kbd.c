@@ -4,20 +4,26 @@
 
 #include <inc/kbd.h>
 #include <inc/trap.h>
-#include <kernel/picirq.h>
+#include <inc/x86.h>
+#include <inc/timer.h>
+#include <kernel/irq.h>
+#include <kernel/restart.h>
+#include <kernel/trap.h>
+#include <kernel/softirq.h>
 #include <inc/stdio.h>
+#include <inc/string.h>
 
 /***** Keyboard input code *****/
 
 #define NO		0
 
-#define SHIFT		(1<<0)
-#define CTL		(1<<1)
-#define ALT		(1<<2)
+#define SHIFT		KMOD_SHIFT
+#define CTL		KMOD_CTL
+#define ALT		KMOD_ALT
 
-#define CAPSLOCK	(1<<3)
-#define NUMLOCK		(1<<4)
-#define SCROLLLOCK	(1<<5)
+#define CAPSLOCK	KMOD_CAPSLOCK
+#define NUMLOCK		KMOD_NUMLOCK
+#define SCROLLLOCK	KMOD_SCROLLLOCK
 
 #define E0ESC		(1<<6)
 
@@ -107,20 +113,33 @@ static uint8_t *charcode[4] = {
 };
 
 /*
- * Get data from the keyboard.  If we finish a character, return it.  Else 0.
- * Return -1 if no data.
+ * Scancodes the interrupt handler read, for kbd_tasklet to decode.
+ * Only the handler moves wpos and only the tasklet moves rpos.
+ */
+#define KBDRAWSIZE 64
+
+static struct {
+	struct {
+		uint64_t tsc;		// when kbd_trap() read it
+		uint8_t data;
+	} buf[KBDRAWSIZE];
+	volatile uint32_t rpos;
+	volatile uint32_t wpos;
+} kbdraw;
+static struct Tasklet kbd_tasklet;
+static uint32_t shift;
+
+// kbd_trap() runs and the scancodes it took, and the scancodes it had
+// to drop because kbdraw was full
+static uint32_t kbd_irqs, kbd_bytes, kbd_maxbatch, raw_overruns;
+
+/*
+ * Decode one scancode.  If we finish a character, return it.  Else 0.
  */
 static int
-kbd_proc_data(void)
+kbd_decode(uint8_t data)
 {
 	int c;
-	uint8_t data;
-	static uint32_t shift;
-
-	if ((inb(KBSTATP) & KBS_DIB) == 0)
-		return -1;
-
-	data = inb(KBDATAP);
 
 	if (data == 0xE0) {
 		// E0 escape character
@@ -149,62 +168,130 @@ kbd_proc_data(void)
 	}
 
 	// Process special keys
-	// Ctrl-Alt-Del: reboot
+	// Ctrl-Alt-Del: restart the kernel in memory
 	if (!(~shift & (CTL | ALT)) && c == KEY_DEL) {
-		cprintf("Rebooting!\n");
-		outb(0x92, 0x3); // courtesy of Chris Frost
+		cprintf("Restarting!\n");
+		warm_restart();
 	}
 
 	return c;
 }
 
+/*
+ * Get data from the keyboard.  If we finish a character, return it.  Else 0.
+ * Return -1 if no data.  *tsc is when the data came in.
+ */
+static int
+kbd_proc_data(uint64_t *tsc)
+{
+	if ((inb(KBSTATP) & KBS_DIB) == 0)
+		return -1;
+	*tsc = read_tsc();
+	return kbd_decode(inb(KBDATAP));
+}
+
+/* The same, from the scancodes kbd_trap() queued */
+static int
+kbd_raw_data(uint64_t *tsc)
+{
+	uint8_t data;
+
+	if (kbdraw.rpos == kbdraw.wpos)
+		return -1;
+	data = kbdraw.buf[kbdraw.rpos % KBDRAWSIZE].data;
+	*tsc = kbdraw.buf[kbdraw.rpos % KBDRAWSIZE].tsc;
+	kbdraw.rpos++;
+	return kbd_decode(data);
+}
+
 /***** General device-independent console code *****/
-// Here we manage the console input buffer,
-// where we stash characters received from the keyboard or serial port
-// whenever the corresponding interrupt occurs.
+// Here we manage the console input queue, where we stash key events
+// from the keyboard whenever its interrupt occurs.  A full queue keeps
+// what it has and counts the events it drops.
 
-#define CONSBUFSIZE 512
+#define CONSBUFSIZE 256		// a power of 2, as the indexes wrap
 
 static struct {
-	uint8_t buf[CONSBUFSIZE];
-	uint32_t rpos;
-	uint32_t wpos;
+	struct KbdEvent buf[CONSBUFSIZE];
+	volatile uint32_t rpos;
+	volatile uint32_t wpos;
 } cons;
+static uint32_t cons_overruns;
+
+// Latency from the IRQ to the consumer taking the event, in cycles
+#define NBUCKETS	32
 
-// called by device interrupt routines to feed input characters
-// into the circular console input buffer.
+static struct {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t hist[NBUCKETS];	// by log2 of the latency
+} lat;
+
+// called by device interrupt routines to feed input events
+// into the circular console input queue.
 static void
-cons_intr(int (*proc)(void))
+cons_intr(int (*proc)(uint64_t *))
 {
+	struct KbdEvent *ev;
+	uint64_t tsc;
 	int c;
 
-	while ((c = (*proc)()) != -1) {
+	while ((c = (*proc)(&tsc)) != -1) {
 		if (c == 0)
 			continue;
-		cons.buf[cons.wpos++] = c;
-		if (cons.wpos == CONSBUFSIZE)
-			cons.wpos = 0;
+		if (cons.wpos - cons.rpos == CONSBUFSIZE) {
+			cons_overruns++;
+			continue;
+		}
+		ev = &cons.buf[cons.wpos % CONSBUFSIZE];
+		ev->ke_tsc = tsc;
+		ev->ke_c = c;
+		ev->ke_mods = shift & (SHIFT | CTL | ALT | CAPSLOCK |
+				       NUMLOCK | SCROLLLOCK);
+		cons.wpos++;
 	}
 }
 
+// Take the next key event into *ev.  Returns 1, or 0 if none waiting.
+int
+kbd_getevent(struct KbdEvent *ev)
+{
+	uint64_t d64;
+	uint32_t d;
+
+	if (cons.rpos == cons.wpos)
+		return 0;
+	*ev = cons.buf[cons.rpos % CONSBUFSIZE];
+	cons.rpos++;
+
+	d64 = read_tsc() - ev->ke_tsc;
+	d = d64 > ~0U ? ~0U : d64;
+	if (lat.count == 0 || d < lat.min)
+		lat.min = d;
+	if (d > lat.max)
+		lat.max = d;
+	lat.count++;
+	lat.sum += d;
+	lat.hist[d ? 31 - __builtin_clz(d) : 0]++;
+	return 1;
+}
+
 // return the next input character from the console, or 0 if none waiting
 int
 cons_getc(void)
 {
-	int c;
+	struct KbdEvent ev;
 
 	// poll for any pending input characters,
 	// so that this function works even when interrupts are disabled
 	// (e.g., when called from the kernel monitor).
 	//kbd_intr();
 
-	// grab the next character from the input buffer.
-	if (cons.rpos != cons.wpos) {
-		c = cons.buf[cons.rpos++];
-		if (cons.rpos == CONSBUFSIZE)
-			cons.rpos = 0;
-		return c;
-	}
+	// grab the next character from the input queue.
+	if (kbd_getevent(&ev))
+		return ev.ke_c;
 	return 0;
 }
 
@@ -217,13 +304,98 @@ kbd_intr(void)
 	cons_intr(kbd_proc_data);
 }
 
+/*
+ * Interrupt handler top half: just take the scancodes off the
+ * controller; kbd_tasklet decodes them with interrupts enabled.
+ */
+static void
+kbd_trap(struct Trapframe *tf, void *arg)
+{
+	uint64_t tsc = read_tsc();
+	uint32_t n = 0;
+	uint8_t data;
+
+	// everything the 8042 has, in one pass
+	while (inb(KBSTATP) & KBS_DIB) {
+		data = inb(KBDATAP);
+		n++;
+		// drop scancodes when the tasklet is that far behind
+		if (kbdraw.wpos - kbdraw.rpos == KBDRAWSIZE) {
+			raw_overruns++;
+			continue;
+		}
+		kbdraw.buf[kbdraw.wpos % KBDRAWSIZE].tsc = tsc;
+		kbdraw.buf[kbdraw.wpos % KBDRAWSIZE].data = data;
+		kbdraw.wpos++;
+	}
+	kbd_irqs++;
+	kbd_bytes += n;
+	if (n > kbd_maxbatch)
+		kbd_maxbatch = n;
+	if (n)
+		tasklet_schedule(&kbd_tasklet);
+}
+
+static void
+kbd_bottom(void *arg)
+{
+	cons_intr(kbd_raw_data);
+}
+
 void kbd_init(void)
 {
 	// Drain the kbd buffer so that Bochs generates interrupts.
   cons.rpos = 0;
   cons.wpos = 0;
 	kbd_intr();
-	irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_KBD));
+	tasklet_init(&kbd_tasklet, kbd_bottom, NULL);
+	trap_register(irq_to_vector(IRQ_KBD), kbd_trap, NULL, "kbd");
+	irq_enable(IRQ_KBD);
+}
+
+// Upper bound of the latency bucket holding the 99th percentile
+static uint32_t
+lat_p99(void)
+{
+	uint32_t want = lat.count - lat.count / 100, seen = 0;
+	int b;
+
+	for (b = 0; b < NBUCKETS - 1; b++)
+		if ((seen += lat.hist[b]) >= want)
+			break;
+	return b == NBUCKETS - 1 ? ~0U : (2U << b) - 1;
+}
+
+void
+kbd_print(void)
+{
+	unsigned long khz = tsc_khz();
+
+	cprintf("kbd IRQs %u, scancodes %u, most in one IRQ %u\n",
+		kbd_irqs, kbd_bytes, kbd_maxbatch);
+	cprintf("dropped: scancodes %u, key events %u; %u events queued\n",
+		raw_overruns, cons_overruns, cons.wpos - cons.rpos);
+	if (lat.count == 0) {
+		cprintf("No key events consumed yet\n");
+		return;
+	}
+	cprintf("IRQ to consumer latency over %u events, in cycles:\n",
+		lat.count);
+	cprintf("  min %u, mean %u, p99 <= %u, max %u\n", lat.min,
+		(uint32_t) (lat.sum / lat.count), lat_p99(), lat.max);
+	if (khz)
+		cprintf("  max %u us at %lu kHz\n",
+			(uint32_t) (lat.max * 1000ULL / khz), khz);
+}
+
+void
+kbd_reset_stats(void)
+{
+	__asm __volatile("cli");
+	kbd_irqs = kbd_bytes = kbd_maxbatch = 0;
+	raw_overruns = cons_overruns = 0;
+	memset(&lat, 0, sizeof(lat));
+	__asm __volatile("sti");
 }
 
 /* high-level console I/O */
@@ -231,7 +403,17 @@ int getc(void)
 {
 	int c;
 
-	while ((c = cons_getc()) == 0)
-		/* do nothing */;
+	// show what was drawn before waiting on the user
+	screen_flush();
+
+	/* Sleep until an interrupt brings something; checking with
+	 * interrupts off, so the keyboard can't slip in before the hlt */
+	for (;;) {
+		__asm __volatile("cli");
+		if ((c = cons_getc()) != 0)
+			break;
+		timer_idle();
+	}
+	__asm __volatile("sti");
 	return c;
 }
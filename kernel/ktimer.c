@@ -0,0 +1,292 @@
+/*
+ * Kernel timers, on a hashed hierarchical timer wheel.
+ *
+ * tv1 has a slot for each of the next 256 ticks.  Each of the four
+ * levels of tvn covers 64 times the span of the one below; a timer sits
+ * in the slot of the lowest level that reaches its expiry, so adding
+ * and cancelling are O(1).  Whenever tv1 wraps, the next slot of tvn[0]
+ * is cascaded, its timers spread into tv1, and so on up the levels.
+ *
+ * timer_handler() only counts jiffies and raises SOFTIRQ_TIMER.  The
+ * wheel turns in ktimer_run(), the handler of that softirq: it catches
+ * up tick by tick to jiffies, cascading and running the callbacks that
+ * fall due.  Callbacks therefore run with interrupts enabled, outside
+ * any IRQ handler.
+ */
+#include <inc/stdio.h>
+#include <inc/error.h>
+#include <inc/timer.h>
+#include <inc/x86.h>
+#include <kernel/ktimer.h>
+#include <kernel/pmap.h>
+
+#define TVR_BITS	8
+#define TVN_BITS	6
+#define TVR_SIZE	(1 << TVR_BITS)
+#define TVN_SIZE	(1 << TVN_BITS)
+#define TVR_MASK	(TVR_SIZE - 1)
+#define TVN_MASK	(TVN_SIZE - 1)
+#define NLEVELS		4
+
+// Slot of 'j' in level 'n' of tvn
+#define TVN_INDEX(j, n)	(((j) >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+static struct Ktimer *tv1[TVR_SIZE];
+static struct Ktimer *tvn[NLEVELS][TVN_SIZE];
+static struct Ktimer *expired;		// timers ktimer_run() is firing
+static unsigned long timer_jiffies;	// next tick the wheel processes
+
+// Per-tick processing cost, for ktimer_print()
+static unsigned long stat_ticks, stat_fired;
+static uint64_t stat_cycles, stat_max;
+
+static void
+list_add(struct Ktimer **head, struct Ktimer *t)
+{
+	if ((t->kt_next = *head))
+		t->kt_next->kt_pprev = &t->kt_next;
+	*head = t;
+	t->kt_pprev = head;
+}
+
+static void
+list_del(struct Ktimer *t)
+{
+	if ((*t->kt_pprev = t->kt_next))
+		t->kt_next->kt_pprev = t->kt_pprev;
+	t->kt_pprev = NULL;
+}
+
+// Put 't' in the slot its expiry hashes to.  Interrupts are off.
+static void
+wheel_add(struct Ktimer *t)
+{
+	unsigned long expires = t->kt_expires;
+	unsigned long idx = expires - timer_jiffies;
+	int n;
+
+	if ((long) idx < 0) {
+		// already due; the next tick processed fires it
+		list_add(&tv1[timer_jiffies & TVR_MASK], t);
+		return;
+	}
+	if (idx < TVR_SIZE) {
+		list_add(&tv1[expires & TVR_MASK], t);
+		return;
+	}
+	for (n = 0; n < NLEVELS - 1; n++)
+		if (idx < 1UL << (TVR_BITS + (n + 1) * TVN_BITS))
+			break;
+	list_add(&tvn[n][TVN_INDEX(expires, n)], t);
+}
+
+void
+ktimer_init(struct Ktimer *t, void (*func)(void *), void *arg)
+{
+	t->kt_next = NULL;
+	t->kt_pprev = NULL;
+	t->kt_func = func;
+	t->kt_arg = arg;
+}
+
+/*
+ * Arm 't' to fire at tick 'expires', whether or not it was pending.
+ * Returns 1 if it was, 0 if not.
+ */
+int
+ktimer_mod(struct Ktimer *t, unsigned long expires)
+{
+	uint32_t eflags = read_eflags();
+	int was;
+
+	__asm __volatile("cli");
+	if ((was = ktimer_pending(t)))
+		list_del(t);
+	t->kt_expires = expires;
+	wheel_add(t);
+	write_eflags(eflags);
+	return was;
+}
+
+/*
+ * Disarm 't'.  Returns 1 if it was pending, 0 if it had fired or was
+ * never armed.
+ */
+int
+ktimer_cancel(struct Ktimer *t)
+{
+	uint32_t eflags = read_eflags();
+	int was;
+
+	__asm __volatile("cli");
+	if ((was = ktimer_pending(t)))
+		list_del(t);
+	write_eflags(eflags);
+	return was;
+}
+
+// Move the timers of tvn[n][index] down the wheel.  Returns 'index',
+// so a zero tells the caller to cascade the next level too.
+static int
+cascade(int n, int index)
+{
+	struct Ktimer *t, *list = tvn[n][index];
+
+	tvn[n][index] = NULL;
+	while ((t = list)) {
+		list = t->kt_next;
+		wheel_add(t);
+	}
+	return index;
+}
+
+/*
+ * Process the ticks up to jiffies, running callbacks with interrupts
+ * enabled.  The timer softirq; softirqs never nest, and neither does
+ * this.
+ */
+void
+ktimer_run(void)
+{
+	uint32_t eflags = read_eflags();
+	struct Ktimer *t;
+	uint64_t t0, c;
+	int idx;
+
+	__asm __volatile("cli");
+	while ((long) (get_tick() - timer_jiffies) >= 0) {
+		t0 = get_time_cycles();
+		idx = timer_jiffies & TVR_MASK;
+		if (idx == 0 &&
+		    !cascade(0, TVN_INDEX(timer_jiffies, 0)) &&
+		    !cascade(1, TVN_INDEX(timer_jiffies, 1)) &&
+		    !cascade(2, TVN_INDEX(timer_jiffies, 2)))
+			cascade(3, TVN_INDEX(timer_jiffies, 3));
+		timer_jiffies++;
+
+		// Callbacks may cancel or rearm timers still on 'expired'
+		if ((expired = tv1[idx]))
+			expired->kt_pprev = &expired;
+		tv1[idx] = NULL;
+		while ((t = expired)) {
+			list_del(t);
+			stat_fired++;
+			__asm __volatile("sti");
+			t->kt_func(t->kt_arg);
+			__asm __volatile("cli");
+		}
+
+		c = get_time_cycles() - t0;
+		stat_ticks++;
+		stat_cycles += c;
+		if (c > stat_max)
+			stat_max = c;
+	}
+	write_eflags(eflags);
+}
+
+/*
+ * The earliest tick within 'limit' ticks from now at which a timer may
+ * fire, for timer_idle(); now + limit if none.  A tick that cascades
+ * counts as one, as do ticks the wheel has yet to catch up on.
+ */
+unsigned long
+ktimer_next(unsigned long limit)
+{
+	unsigned long j;
+
+	if ((long) (get_tick() - timer_jiffies) >= 0)
+		return get_tick();
+	for (j = timer_jiffies; j - timer_jiffies < limit; j++)
+		if (tv1[j & TVR_MASK] || (j & TVR_MASK) == 0)
+			return j;
+	return get_tick() + limit;
+}
+
+void
+ktimer_print(void)
+{
+	cprintf("Timer wheel at tick %lu: %lu ticks processed, %lu timers fired\n",
+		timer_jiffies, stat_ticks, stat_fired);
+	if (stat_ticks)
+		cprintf("Per tick: %llu cycles mean, %llu max (%llu ns, %llu ns)\n",
+			stat_cycles / stat_ticks, stat_max,
+			stat_cycles / stat_ticks * 1000000 / tsc_khz(),
+			stat_max * 1000000 / tsc_khz());
+}
+
+/*
+ * Stress benchmark: arm 'n' timers, most due in the next few seconds
+ * and one in eight far out in the upper levels, rearm half of them,
+ * wait for the near ones to fire, then cancel the far ones.
+ */
+static volatile int bench_fired;
+
+static void
+bench_func(void *arg)
+{
+	bench_fired++;
+}
+
+int
+ktimer_bench(int n)
+{
+	struct Ktimer *timers;
+	physaddr_t pa;
+	size_t npg;
+	uint32_t seed = 1;
+	unsigned long now;
+	uint64_t t0, add, mod, cancel;
+	int i, near = 0, nmod = 0, ncancel = 0;
+
+	// more than memory could hold would wrap the size
+	if (n <= 0 || n > (MAXPAGES * PGSIZE) / sizeof(struct Ktimer))
+		return -E_NO_MEM;
+	npg = ROUNDUP(n * sizeof(struct Ktimer), PGSIZE) / PGSIZE;
+	if (page_alloc_run(npg, &pa) < 0)
+		return -E_NO_MEM;
+	timers = KADDR(pa);
+	bench_fired = 0;
+	stat_ticks = stat_fired = 0;
+	stat_cycles = stat_max = 0;
+
+#define RAND()	(seed = seed * 1103515245 + 12345, seed >> 8)
+	now = get_tick();
+	t0 = get_time_cycles();
+	for (i = 0; i < n; i++) {
+		ktimer_init(&timers[i], bench_func, NULL);
+		ktimer_mod(&timers[i], now + 1 + (i % 8 ? RAND() % (2 * TIME_HZ)
+					       : (1 << 20) + RAND() % (1 << 24)));
+	}
+	add = get_time_cycles() - t0;
+
+	t0 = get_time_cycles();
+	for (i = 0; i < n; i += 2)
+		if (i % 8) {
+			ktimer_mod(&timers[i], now + 1 + RAND() % (3 * TIME_HZ));
+			nmod++;
+		}
+	mod = get_time_cycles() - t0;
+	near = n - (n + 7) / 8;
+
+	// sleep until the near timers are done
+	for (;;) {
+		__asm __volatile("cli");
+		if (bench_fired >= near)
+			break;
+		timer_idle();
+	}
+	__asm __volatile("sti");
+
+	t0 = get_time_cycles();
+	for (i = 0; i < n; i += 8, ncancel++)
+		ktimer_cancel(&timers[i]);
+	cancel = get_time_cycles() - t0;
+#undef RAND
+
+	cprintf("%d timers: add %llu, mod %llu, cancel %llu cycles each\n", n,
+		add / n, nmod ? mod / nmod : 0, cancel / ncancel);
+	ktimer_print();
+	page_free_run(pa, npg);
+	return 0;
+}
@@ -0,0 +1,28 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KTIMER_H
+#define JOS_KERN_KTIMER_H
+
+#include <inc/types.h>
+
+// A kernel timer: calls kt_func(kt_arg) once jiffies reaches kt_expires.
+// Embed one wherever it is needed and set it up with ktimer_init().
+struct Ktimer {
+	struct Ktimer *kt_next;
+	struct Ktimer **kt_pprev;	// link pointing at us; NULL if idle
+	unsigned long kt_expires;
+	void (*kt_func)(void *arg);
+	void *kt_arg;
+};
+
+void ktimer_init(struct Ktimer *t, void (*func)(void *), void *arg);
+int ktimer_mod(struct Ktimer *t, unsigned long expires);
+int ktimer_cancel(struct Ktimer *t);
+#define ktimer_pending(t)	((t)->kt_pprev != NULL)
+
+void ktimer_run(void);
+unsigned long ktimer_next(unsigned long limit);
+void ktimer_print(void);
+int ktimer_bench(int n);
+
+#endif /* !JOS_KERN_KTIMER_H */
@@ -3,20 +3,34 @@
 #include <inc/shell.h>
 #include <inc/timer.h>
 #include <inc/x86.h>
+#include <inc/boot.h>
 #include <kernel/trap.h>
-#include <kernel/picirq.h>
+#include <kernel/irq.h>
+#include <kernel/pmap.h>
+#include <kernel/syscall.h>
 
 extern void init_video(void);
 void kernel_main(void)
 {
+	boottime_init();
+
 	init_video();
+	boottime_stamp(BT_VIDEO);
+
+	mem_init();
+	boottime_stamp(BT_MEM);
+
+	irq_init();
+	boottime_stamp(BT_PIC);
+
+	trap_init();
+	syscall_init();
+	boottime_stamp(BT_TRAP);
 
-	pic_init();
-  /* TODO: You should uncomment them
-   */
-	 //kbd_init();
-	 //timer_init();
-	 trap_init();
+	kbd_init();
+	timer_init();
+	clock_init();
+	boottime_stamp(BT_DEVICES);
 
 	/* Enable interrupt */
 	__asm __volatile("sti");
@@ -11,6 +11,15 @@
 uint16_t irq_mask_8259A = 0xFFFF & ~(1<<IRQ_SLAVE);
 static bool didinit;
 
+// What each mask register holds, so unchanged bytes are not rewritten
+static uint8_t hw_mask[2] = { 0xFF, 0xFF };
+static uint32_t mask_writes, mask_skipped;
+
+// Interrupts acknowledged per IRQ, and the spurious IRQ 7s and 15s
+// that were not
+static uint32_t irq_count[MAX_IRQS];
+static uint32_t spurious_master, spurious_slave;
+
 /* Initialize the 8259A interrupt controllers. */
 void
 pic_init(void)
@@ -20,6 +29,7 @@ pic_init(void)
 	// mask all interrupts
 	outb(IO_PIC1+1, 0xFF);
 	outb(IO_PIC2+1, 0xFF);
+	hw_mask[0] = hw_mask[1] = 0xFF;
 
 	// Set up master (8259A-1)
 
@@ -44,14 +54,14 @@ pic_init(void)
 	//	  can be hardwired).
 	//    a:  1 = Automatic EOI mode
 	//    p:  0 = MCS-80/85 mode, 1 = intel x86 mode
-	outb(IO_PIC1+1, 0x3);
+	// Normal EOI, so the ISR tells a real IRQ 7 from a spurious one
+	// and pic_eoi() retires exactly the IRQ that was handled.
+	outb(IO_PIC1+1, 0x01);
 
 	// Set up slave (8259A-2)
 	outb(IO_PIC2, 0x11);			// ICW1
 	outb(IO_PIC2+1, IRQ_OFFSET + 8);	// ICW2
 	outb(IO_PIC2+1, IRQ_SLAVE);		// ICW3
-	// NB Automatic EOI mode doesn't tend to work on the slave.
-	// Linux source code says it's "to be investigated".
 	outb(IO_PIC2+1, 0x01);			// ICW4
 
 	// OCW3:  0ef01prs
@@ -75,8 +85,19 @@ irq_setmask_8259A(uint16_t mask)
 	irq_mask_8259A = mask;
 	if (!didinit)
 		return;
-	outb(IO_PIC1+1, (char)mask);
-	outb(IO_PIC2+1, (char)(mask >> 8));
+	// Each outb to the PIC costs about a microsecond
+	if (hw_mask[0] != (uint8_t)mask) {
+		hw_mask[0] = mask;
+		outb(IO_PIC1+1, (char)mask);
+		mask_writes++;
+	} else
+		mask_skipped++;
+	if (hw_mask[1] != (uint8_t)(mask >> 8)) {
+		hw_mask[1] = mask >> 8;
+		outb(IO_PIC2+1, (char)(mask >> 8));
+		mask_writes++;
+	} else
+		mask_skipped++;
 	/*cprintf("enabled interrupts:");
 	for (i = 0; i < 16; i++)
 		if (~mask & (1<<i))
@@ -84,3 +105,65 @@ irq_setmask_8259A(uint16_t mask)
 	cprintf("\n");*/
 }
 
+
+// In-service register of the PIC at 'port'
+static uint8_t
+pic_isr(int port)
+{
+	uint8_t isr;
+
+	outb(port, 0x0b);		// OCW3: read ISR
+	isr = inb(port);
+	outb(port, 0x0a);		// back to IRR
+	return isr;
+}
+
+/*
+ * Was this IRQ 7 or 15 spurious?  The 8259A raises its lowest priority
+ * line when a request goes away before the CPU acknowledges it, without
+ * setting the line's ISR bit.  A spurious IRQ 15 did put the cascade
+ * line in service on the master, so retire that; a spurious IRQ must
+ * get no EOI of its own, which could retire a real one in service.
+ */
+bool
+pic_spurious(int irq)
+{
+	if (irq == 7 && !(pic_isr(IO_PIC1) & 0x80)) {
+		spurious_master++;
+		return 1;
+	}
+	if (irq == 15 && !(pic_isr(IO_PIC2) & 0x80)) {
+		spurious_slave++;
+		outb(IO_PIC1, 0x60 | IRQ_SLAVE);
+		return 1;
+	}
+	return 0;
+}
+
+// Retire 'irq' with a specific EOI, slave first and then the cascade
+// line on the master
+void
+pic_eoi(int irq)
+{
+	irq_count[irq]++;
+	if (irq >= 8) {
+		outb(IO_PIC2, 0x60 | (irq & 7));
+		irq = IRQ_SLAVE;
+	}
+	outb(IO_PIC1, 0x60 | irq);
+}
+
+void
+pic_print(void)
+{
+	int i;
+
+	cprintf("8259A PIC pair, IRQs 0-15, mask 0x%04x\n", irq_mask_8259A);
+	for (i = 0; i < MAX_IRQS; i++)
+		if (irq_count[i])
+			cprintf("  IRQ %2d delivered %u\n", i, irq_count[i]);
+	cprintf("  spurious IRQ 7 %u, IRQ 15 %u\n",
+		spurious_master, spurious_slave);
+	cprintf("  mask register writes %u, skipped as unchanged %u\n",
+		mask_writes, mask_skipped);
+}
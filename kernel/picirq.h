@@ -23,6 +23,9 @@
 extern uint16_t irq_mask_8259A;
 void pic_init(void);
 void irq_setmask_8259A(uint16_t mask);
+bool pic_spurious(int irq);
+void pic_eoi(int irq);
+void pic_print(void);
 #endif // !__ASSEMBLER__
 
 #endif // !JOS_KERN_PICIRQ_H
@@ -0,0 +1,317 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/stdio.h>
+#include <inc/error.h>
+#include <inc/boot.h>
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <kernel/pmap.h>
+
+/*
+ * Physical frame allocator.
+ *
+ * Every frame below PHYSMEM_MAX has a bit in frame_map that is set while
+ * the frame is free, so a scan skips 32 used frames per word.
+ * page_alloc() and page_free() go through frame_cache, a small stack of
+ * free frames, and only touch the bitmap when the stack runs empty or
+ * full.  Frames on the stack are clear in frame_map, as if allocated.
+ */
+
+#define MAPBITS		32
+#define MAPWORDS	(MAXPAGES / MAPBITS)
+#define CACHESIZE	64
+
+size_t npages;			// frames up to the top of usable memory
+static uint32_t frame_map[MAPWORDS];
+static size_t nmapwords;	// words of frame_map covering npages
+static size_t nmapfree;		// free frames in frame_map
+static size_t map_hint;		// word the next refill scan starts at
+
+static ppn_t frame_cache[CACHESIZE];
+static size_t ncache;
+
+extern char kernel_load_addr[], data_copy_end[];
+extern uint32_t entry_pgdir[];
+
+static int
+e820_count(struct BootInfo *bi)
+{
+	uint32_t base = BOOTINFO_ADDR + BI_E820;	// boot.S's physical view
+	uint32_t n;
+
+	if (bi->bi_e820_end < base ||
+	    (bi->bi_e820_end - base) % sizeof(struct E820Entry))
+		return 0;
+	n = (bi->bi_e820_end - base) / sizeof(struct E820Entry);
+	return n < E820_MAX ? n : E820_MAX;
+}
+
+// Read a 16-bit value from the NVRAM registers r and r + 1
+static unsigned
+nvram_read(int r)
+{
+	unsigned lo;
+
+	outb(IO_RTC, r);
+	lo = inb(IO_RTC + 1);
+	outb(IO_RTC, r + 1);
+	return lo | inb(IO_RTC + 1) << 8;
+}
+
+// Mark frames [from, to) free or in use
+static void
+map_range(ppn_t from, ppn_t to, bool isfree)
+{
+	uint32_t bit;
+
+	if (to > MAXPAGES)
+		to = MAXPAGES;
+	for (; from < to; from++) {
+		bit = 1 << (from % MAPBITS);
+		if (!(frame_map[from / MAPBITS] & bit) == !isfree)
+			continue;
+		frame_map[from / MAPBITS] ^= bit;
+		if (isfree)
+			nmapfree++;
+		else
+			nmapfree--;
+	}
+}
+
+// Free the whole pages inside [start, start + len)
+static void
+add_ram(uint64_t start, uint64_t len)
+{
+	uint32_t lo, hi;
+
+	if (start >= PHYSMEM_MAX)
+		return;
+	lo = ROUNDUP((uint32_t) start, PGSIZE);
+	if (start + len > PHYSMEM_MAX)
+		hi = PHYSMEM_MAX;
+	else
+		hi = ROUNDDOWN((uint32_t) (start + len), PGSIZE);
+	if (lo >= hi)
+		return;
+	map_range(PGNUM(lo), PGNUM(hi), 1);
+	if (PGNUM(hi) > npages)
+		npages = PGNUM(hi);
+}
+
+void
+mem_init(void)
+{
+	struct BootInfo *bi = (struct BootInfo *) KADDR(BOOTINFO_ADDR);
+	struct E820Entry *e;
+	int i, n;
+
+	n = e820_count(bi);
+	for (i = 0; i < n; i++) {
+		e = &bi->bi_e820[i];
+		if (e->e_type == E820_RAM)
+			add_ram(e->e_addr, e->e_len);
+	}
+	if (n == 0) {
+		// No E820 map: fall back on the sizes kept in CMOS
+		add_ram(0, nvram_read(NVRAM_BASELO) * 1024);
+		add_ram(0x100000, nvram_read(NVRAM_EXTLO) * 1024);
+		add_ram(0x1000000, (uint64_t) nvram_read(NVRAM_EXT16LO) * 65536);
+	}
+
+	// Frame 0 holds the real-mode IDT and BIOS data, the BootInfo
+	// page is read again on every restart, and then there's us, with
+	// the copy of .data that warm restarts start from.
+	map_range(0, 1, 0);
+	map_range(PGNUM(BOOTINFO_ADDR), PGNUM(BOOTINFO_ADDR) + 1, 0);
+	map_range(PGNUM(PADDR(kernel_load_addr)),
+		  PGNUM(PADDR(ROUNDUP((char *) data_copy_end, PGSIZE))), 0);
+
+	nmapwords = ROUNDUP(npages, MAPBITS) / MAPBITS;
+}
+
+void
+print_e820(void)
+{
+	static const char * const types[] = {
+		[E820_RAM]	= "usable",
+		[E820_RESERVED]	= "reserved",
+		[E820_ACPI]	= "ACPI data",
+		[E820_NVS]	= "ACPI NVS",
+		[E820_BAD]	= "bad",
+	};
+	struct BootInfo *bi = (struct BootInfo *) KADDR(BOOTINFO_ADDR);
+	struct E820Entry *e;
+	int i, n;
+
+	n = e820_count(bi);
+	if (n == 0)
+		cprintf("No E820 map, memory size from CMOS\n");
+	for (i = 0; i < n; i++) {
+		e = &bi->bi_e820[i];
+		cprintf("  %016llx-%016llx %s\n", e->e_addr,
+			e->e_addr + e->e_len - 1,
+			e->e_type < sizeof(types)/sizeof(types[0]) &&
+			types[e->e_type] ? types[e->e_type] : "unknown");
+	}
+}
+
+size_t
+page_nfree(void)
+{
+	return nmapfree + ncache;
+}
+
+// Move up to half a cache of free frames from one bitmap word onto the
+// cache, starting the scan where the last refill left off.
+static void
+cache_refill(void)
+{
+	size_t i, w;
+	uint32_t bits;
+	int b;
+
+	for (i = 0; i < nmapwords; i++) {
+		w = (map_hint + i) % nmapwords;
+		if (frame_map[w] != 0)
+			break;
+	}
+	if (i == nmapwords)
+		return;
+	map_hint = w;
+	bits = frame_map[w];
+	while (bits != 0 && ncache < CACHESIZE / 2) {
+		b = __builtin_ctz(bits);
+		bits &= bits - 1;
+		frame_cache[ncache++] = w * MAPBITS + b;
+		nmapfree--;
+	}
+	frame_map[w] = bits;
+}
+
+// Allocate one physical frame.
+// Returns 0 and the frame's address in *pa, or -E_NO_MEM.
+int
+page_alloc(physaddr_t *pa)
+{
+	if (ncache == 0)
+		cache_refill();
+	if (ncache == 0)
+		return -E_NO_MEM;
+	*pa = frame_cache[--ncache] << PGSHIFT;
+	return 0;
+}
+
+void
+page_free(physaddr_t pa)
+{
+	if (ncache < CACHESIZE)
+		frame_cache[ncache++] = PGNUM(pa);
+	else
+		map_range(PGNUM(pa), PGNUM(pa) + 1, 1);
+}
+
+// Find 'n' free frames in a row, a bitmap word at a time.
+static int
+map_find_run(size_t n, ppn_t *start)
+{
+	size_t w, run = 0;
+	uint32_t bits;
+	int b;
+
+	for (w = 0; w < nmapwords; w++) {
+		bits = frame_map[w];
+		if (bits == 0) {
+			run = 0;
+			continue;
+		}
+		if (bits == ~0U) {
+			if (run == 0)
+				*start = w * MAPBITS;
+			run += MAPBITS;
+			if (run >= n)
+				return 0;
+			continue;
+		}
+		for (b = 0; b < MAPBITS; b++) {
+			if (!(bits & (1 << b))) {
+				run = 0;
+				continue;
+			}
+			if (run++ == 0)
+				*start = w * MAPBITS + b;
+			if (run >= n)
+				return 0;
+		}
+	}
+	return -E_NO_MEM;
+}
+
+// Allocate 'n' physically contiguous frames.
+// Returns 0 and the first frame's address in *pa, or -E_NO_MEM.
+int
+page_alloc_run(size_t n, physaddr_t *pa)
+{
+	ppn_t start;
+
+	if (n == 0)
+		return -E_INVAL;
+	if (map_find_run(n, &start) < 0) {
+		// The frames we need may be sitting in the cache
+		while (ncache > 0) {
+			ncache--;
+			map_range(frame_cache[ncache], frame_cache[ncache] + 1, 1);
+		}
+		if (map_find_run(n, &start) < 0)
+			return -E_NO_MEM;
+	}
+	map_range(start, start + n, 0);
+	*pa = start << PGSHIFT;
+	return 0;
+}
+
+void
+page_free_run(physaddr_t pa, size_t n)
+{
+	map_range(PGNUM(pa), PGNUM(pa) + n, 1);
+}
+
+// Map the device memory at [pa, pa + size) uncached, 4MB at a time.
+// Addresses from KERNBASE + KERNSIZE up are free for that, so the
+// mapping is 1:1.  Returns the virtual address, or NULL if 'pa' is
+// below that.
+void *
+mmio_map(physaddr_t pa, size_t size)
+{
+	uint32_t i;
+
+	if (pa < KERNBASE + KERNSIZE || size == 0 || pa + size - 1 < pa)
+		return NULL;
+	for (i = PDX(pa); i <= PDX(pa + size - 1); i++)
+		entry_pgdir[i] = i << PDXSHIFT | PTE_P | PTE_W | PTE_PS
+			| PTE_PCD | PTE_PWT | PTE_G;
+	return (void *) pa;
+}
+
+// Map the frame at 'pa' at user address 'va', through a page table
+// of its own.  The page directory entry covering 'va' must not be one
+// of the kernel's 4MB pages.  Returns 0, -E_INVAL or -E_NO_MEM.
+int
+page_map_user(uintptr_t va, physaddr_t pa)
+{
+	uint32_t *pde = &entry_pgdir[PDX(va)];
+	physaddr_t pt;
+	int r;
+
+	if (va >= KERNBASE || (*pde & PTE_PS))
+		return -E_INVAL;
+	if (!(*pde & PTE_P)) {
+		if ((r = page_alloc(&pt)) < 0)
+			return r;
+		memset(KADDR(pt), 0, PGSIZE);
+		*pde = pt | PTE_P | PTE_W | PTE_U;
+	}
+	((uint32_t *) KADDR(PTE_ADDR(*pde)))[PTX(va)] =
+		PTE_ADDR(pa) | PTE_P | PTE_W | PTE_U;
+	invlpg((void *) va);
+	return 0;
+}
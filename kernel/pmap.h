@@ -0,0 +1,38 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PMAP_H
+#define JOS_KERN_PMAP_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+// Physical memory above this is ignored; the frame bitmap is static,
+// and the kernel only maps KERNSIZE bytes anyway.
+#define PHYSMEM_MAX	KERNSIZE
+#define MAXPAGES	(PHYSMEM_MAX / PGSIZE)
+
+// CMOS NVRAM, for memory sizes when the BIOS gave no E820 map
+#define IO_RTC		0x70
+#define NVRAM_BASELO	0x15	// base memory size in KB
+#define NVRAM_EXTLO	0x17	// memory between 1MB and 16MB in KB
+#define NVRAM_EXT16LO	0x34	// memory above 16MB in 64KB units
+
+// Kernel virtual address <-> physical address, for memory below KERNSIZE
+#define PADDR(kva)	((physaddr_t) (kva) - KERNBASE)
+#define KADDR(pa)	((void *) ((physaddr_t) (pa) + KERNBASE))
+
+extern size_t npages;
+
+void mem_init(void);
+void print_e820(void);
+size_t page_nfree(void);
+
+int page_alloc(physaddr_t *pa);
+void page_free(physaddr_t pa);
+int page_alloc_run(size_t n, physaddr_t *pa);
+void page_free_run(physaddr_t pa, size_t n);
+
+void *mmio_map(physaddr_t pa, size_t size);
+int page_map_user(uintptr_t va, physaddr_t pa);
+
+#endif /* !JOS_KERN_PMAP_H */
@@ -0,0 +1,41 @@
+/*
+ * Kernel restart.
+ *
+ * warm_restart() skips the BIOS and the boot loader: the kernel image
+ * is still in memory, and entry.S saved .data as loaded, so
+ * restart_entry (entry.S) only needs to put .data back and run the
+ * entry path again.  kernel_main() then programs every device afresh;
+ * here we just keep them quiet until it does.
+ */
+#include <inc/boot.h>
+#include <inc/x86.h>
+#include <kernel/irq.h>
+#include <kernel/pmap.h>
+#include <kernel/restart.h>
+
+extern void restart_entry(void) __attribute__((noreturn));
+
+void
+warm_restart(void)
+{
+	struct BootInfo *bi = (struct BootInfo *) KADDR(BOOTINFO_ADDR);
+
+	__asm __volatile("cli");
+
+	irq_shutdown();
+
+	// There is no BIOS or boot sector this time around; the restart
+	// counts as the 'bootmain kernel load' phase in 'boottime'.
+	bi->bi_tsc[BT_BOOTSECT] = bi->bi_tsc[BT_PROTMODE] = read_tsc();
+
+	restart_entry();
+}
+
+// Full reset through the BIOS
+void
+cold_reboot(void)
+{
+	outb(0x92, 0x3); // courtesy of Chris Frost
+	while (1)
+		/* do nothing */;
+}
@@ -0,0 +1,9 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_RESTART_H
+#define JOS_KERN_RESTART_H
+
+void warm_restart(void) __attribute__((noreturn));
+void cold_reboot(void) __attribute__((noreturn));
+
+#endif /* !JOS_KERN_RESTART_H */
@@ -2,6 +2,21 @@
 #include <inc/x86.h>
 #include <inc/string.h>
 #include <inc/stdio.h>
+#include <kernel/pmap.h>
+#include <kernel/ktimer.h>
+#include <inc/timer.h>
+
+#define ROWS	25
+#define COLS	80
+#define ALL_ROWS	((1 << ROWS) - 1)
+#define VGA_ROWS	(0x8000 / (COLS * 2))	/* rows in 32KB of text memory */
+
+/* CRT controller */
+#define CRTC_ADDR	0x3D4
+#define CRTC_START_HI	0x0C
+#define CRTC_START_LO	0x0D
+#define CRTC_CURSOR_HI	0x0E
+#define CRTC_CURSOR_LO	0x0F
 
 /* These define our textpointer, our background and foreground
 *  colors (attributes), and x and y cursor coordinates */
@@ -9,6 +24,50 @@ unsigned short *textmemptr;
 int attrib = 0x0F;
 int csr_x = 0, csr_y = 0;
 
+/* VGA text memory is uncached and slow, so textmemptr points at a
+*  shadow copy in normal RAM instead and everything draws there.
+*  Each row drawn on gets its bit in dirty_rows, and screen_flush()
+*  copies just those rows out to vgamem, with dword stores.  It runs
+*  when cprintf() finishes, before getc() waits for a key, and on the
+*  tick after anything else, such as a bare putch(), dirties a row. */
+static unsigned short shadow[VGA_ROWS * COLS];
+static unsigned short *vgamem;
+static volatile uint32_t dirty_rows;
+static struct Ktimer flush_timer;
+
+/* Scrolling moves the screen down through the whole 32KB of text
+*  memory instead of moving the text up: the screen starts at row
+*  top of both shadow and vgamem, and the CRTC start address follows
+*  it.  Only when the screen reaches the end of that memory is it
+*  copied back to the start.  shown_top is where the CRTC shows. */
+static int top, shown_top;
+
+/* Set while screen_flush() copies rows out.  A flush that interrupts
+*  it, from the flush timer or a handler's cprintf(), must not move
+*  the CRTC start to rows not copied yet, so it leaves the work to
+*  the timer instead. */
+static bool flushing;
+
+/* The cursor is only tracked in csr_x and csr_y as we draw; the flush
+*  puts the hardware cursor there, if that is not where it was. */
+static int shown_csr;
+
+/* For screen_print_stats() */
+static uint32_t nchars, nflushes, nrows_copied, nscrolls, nwraps;
+static uint32_t ncsr_writes;
+
+static void arm_flush(void)
+{
+    if (!ktimer_pending(&flush_timer))
+        ktimer_mod(&flush_timer, get_tick() + 1);
+}
+
+static void mark_dirty(uint32_t rows)
+{
+    dirty_rows |= rows;
+    arm_flush();
+}
+
 /* Scrolls the screen */
 void scroll(void)
 {
@@ -19,22 +78,47 @@ void scroll(void)
     blank = 0x0 | (attrib << 8);
 
     /* Row 25 is the end, this means we need to scroll up */
-    if(csr_y >= 25)
+    if(csr_y >= ROWS)
     {
-        /* Move the current text chunk that makes up the screen
-        *  back in the buffer by a line */
-        temp = csr_y - 25 + 1;
-        memcpy (textmemptr, textmemptr + temp * 80, (25 - temp) * 80 * 2);
+        uint32_t eflags;
+        int i, newtop;
+
+        /* Move the screen down over the text memory by a line; at
+        *  the end, copy what stays on screen back to the start */
+        temp = csr_y - ROWS + 1;
+        newtop = top + temp;
+        if (newtop + ROWS > VGA_ROWS)
+        {
+            memmove (shadow, shadow + newtop * COLS, (ROWS - temp) * COLS * 2);
+            newtop = 0;
+            nwraps++;
+        }
 
         /* Finally, we set the chunk of memory that occupies
         *  the last line of text to our 'blank' character */
-        memset (textmemptr + (25 - temp) * 80, blank, 80);
-        csr_y = 25 - 1;
+        for (i = (ROWS - temp) * COLS; i < ROWS * COLS; i++)
+            shadow[newtop * COLS + i] = blank;
+        csr_y = ROWS - 1;
+        nscrolls++;
+
+        /* The rows still to flush moved up with the text, and the
+        *  new ones need flushing; after a wrap, all of them do */
+        eflags = read_eflags();
+        __asm __volatile("cli");
+        if (newtop == 0)
+            dirty_rows = ALL_ROWS;
+        else
+            dirty_rows >>= temp;
+        top = newtop;
+        textmemptr = shadow + top * COLS;
+        write_eflags(eflags);
+        mark_dirty(ALL_ROWS & ~(ALL_ROWS >> temp));
     }
 }
 
 /* Updates the hardware cursor: the little blinking line
-*  on the screen under the last character pressed! */
+*  on the screen under the last character pressed!  Only
+*  screen_flush() calls this, once per batch of output. */
 void move_csr(void)
 {
     unsigned short temp;
@@ -42,7 +126,11 @@ void move_csr(void)
     /* The equation for finding the index in a linear
     *  chunk of memory can be represented by:
     *  Index = [(y * width) + x] */
-    temp = csr_y * 80 + csr_x;
+    temp = (top + csr_y) * 80 + csr_x;
+    if (temp == shown_csr)
+        return;
+    shown_csr = temp;
+    ncsr_writes++;
 
     /* This sends a command to indicies 14 and 15 in the
     *  CRT Control Register of the VGA controller. These
@@ -51,10 +139,8 @@ void move_csr(void)
     *  learn more, you should look up some VGA specific
     *  programming documents. A great start to graphics:
     *  http://www.brackeen.com/home/vga */
-    outb(0x3D4, 14);
-    outb(0x3D5, temp >> 8);
-    outb(0x3D4, 15);
-    outb(0x3D5, temp);
+    outw(CRTC_ADDR, CRTC_CURSOR_HI | (temp & 0xFF00));
+    outw(CRTC_ADDR, CRTC_CURSOR_LO | ((temp & 0xFF) << 8));
 }
 
 /* Clears the screen */
@@ -69,14 +155,75 @@ void cls()
 
     /* Sets the entire screen to spaces in our current
     *  color */
-    for(i = 0; i < 25; i++)
-        memset (textmemptr + i * 80, blank, 80);
+    for(i = 0; i < ROWS * COLS; i++)
+        textmemptr[i] = blank;
+    mark_dirty(ALL_ROWS);
 
     /* Update out virtual cursor, and then move the
     *  hardware cursor */
     csr_x = 0;
     csr_y = 0;
+    screen_flush();
+}
+
+/* Copies the rows drawn on since the last flush out to VGA memory.
+*  A row drawn on while we copy is marked again, and goes next time.
+*  Only the flush that copied the rows under top moves the CRTC. */
+void screen_flush(void)
+{
+    uint32_t rows, eflags, start;
+    int y, t;
+
+    eflags = read_eflags();
+    __asm __volatile("cli");
+    if (flushing)
+    {
+        arm_flush();
+        write_eflags(eflags);
+        return;
+    }
+    rows = dirty_rows;
+    dirty_rows = 0;
+    t = top;
+    if (rows == 0 && t == shown_top)
+    {
+        write_eflags(eflags);
+        move_csr();
+        return;
+    }
+    flushing = 1;
+    write_eflags(eflags);
+
+    nflushes++;
+    for (y = t; rows; y++, rows >>= 1)
+        if (rows & 1)
+        {
+            /* 160 aligned bytes: memcpy does them as rep movsl */
+            memcpy (vgamem + y * COLS, shadow + y * COLS, COLS * 2);
+            nrows_copied++;
+        }
+
+    /* Then show them: index and data in one outw per byte */
+    if (t != shown_top)
+    {
+        start = t * COLS;
+        outw(CRTC_ADDR, CRTC_START_HI | (start & 0xFF00));
+        outw(CRTC_ADDR, CRTC_START_LO | ((start & 0xFF) << 8));
+        shown_top = t;
+    }
     move_csr();
+    flushing = 0;
+}
+
+void screen_print_stats(void)
+{
+    cprintf("VGA console: %u characters, %u flushes, %u rows copied\n",
+            nchars, nflushes, nrows_copied);
+    cprintf("  %u hardware scrolls, %u wraps to the start of text memory\n",
+            nscrolls, nwraps);
+    /* Moving the cursor for each character took four outb */
+    cprintf("  %u cursor updates, %u cursor port writes avoided\n",
+            ncsr_writes, 4 * nchars - 2 * ncsr_writes);
 }
 
 /* Puts a single character on the screen */
@@ -85,12 +232,15 @@ void putch(unsigned char c)
     unsigned short *where;
     unsigned short att = attrib << 8;
 
+    nchars++;
+
     /* Handle a backspace, by moving the cursor back one space */
     if(c == 0x08)
     {
         if(csr_x != 0) {
           where = (textmemptr-1) + (csr_y * 80 + csr_x);
           *where = 0x0 | att;	/* Character AND attributes: color */
+          mark_dirty(1 << csr_y);
           csr_x--;
         }
     }
@@ -122,6 +272,7 @@ void putch(unsigned char c)
     {
         where = textmemptr + (csr_y * 80 + csr_x);
         *where = c | att;	/* Character AND attributes: color */
+        mark_dirty(1 << csr_y);
         csr_x++;
     }
 
@@ -133,20 +284,67 @@ void putch(unsigned char c)
         csr_y++;
     }
 
-    /* Scroll the screen if needed, and finally move the cursor */
+    /* Scroll the screen if needed; the cursor follows on the
+    *  next flush */
     scroll();
-    move_csr();
+    arm_flush();
 }
 
-/* Uses the above routine to output a string... */
-void puts(unsigned char *text)
+/* Puts len bytes of buf on the screen.  A run of printable
+*  characters goes into its row in one pass: the destination is
+*  worked out once and the cells stored two to a dword.  Control
+*  characters go through putch() as they come. */
+void console_write(const char *buf, size_t len)
 {
-    int i;
+    const unsigned char *s = (const unsigned char *) buf;
+    const unsigned char *e = s + len;
+    uint32_t att = attrib << 8;
+    unsigned short *where;
+    uint32_t *w;
+    int i, n;
 
-    for (i = 0; i < strlen(text); i++)
+    while (s < e)
     {
-        putch(text[i]);
+        if (*s < ' ')
+        {
+            putch(*s++);
+            continue;
+        }
+
+        /* The run ends at a control character or the end of the row */
+        for (n = 1; s + n < e && s[n] >= ' ' && csr_x + n < COLS; n++)
+            ;
+        where = textmemptr + (csr_y * COLS + csr_x);
+        i = 0;
+        if ((uintptr_t) where & 2)
+        {
+            where[0] = s[0] | att;
+            i = 1;
+        }
+        for (w = (uint32_t *) (where + i); i + 1 < n; i += 2)
+            *w++ = (s[i] | att) | (s[i + 1] | att) << 16;
+        if (i < n)
+            where[i] = s[i] | att;
+        mark_dirty(1 << csr_y);
+        nchars += n;
+        s += n;
+
+        csr_x += n;
+        if (csr_x >= COLS)
+        {
+            csr_x = 0;
+            csr_y++;
+            scroll();
+        }
     }
+    arm_flush();
+}
+
+/* Uses the above routine to output a string... */
+void puts(unsigned char *text)
+{
+    console_write((const char *) text, strlen((const char *) text));
+    screen_flush();
 }
 
 /* Sets the forecolor and backcolor that we will use */
@@ -158,9 +356,19 @@ void settextcolor(unsigned char forecolor, unsigned char backcolor)
     attrib = (backcolor << 4) | (forecolor & 0x0F);
 }
 
+static void flush_tick(void *arg)
+{
+    screen_flush();
+}
+
 /* Sets our text-mode VGA pointer, then clears the screen for us */
 void init_video(void)
 {
-    textmemptr = (unsigned short *)0xB8000;
+    vgamem = (unsigned short *)KADDR(0xB8000);
+    textmemptr = shadow;
+    /* A warm restart leaves the CRTC wherever it was */
+    shown_top = -1;
+    shown_csr = -1;
+    ktimer_init(&flush_timer, flush_tick, NULL);
     cls();
 }
@@ -2,6 +2,15 @@
 #include <inc/string.h>
 #include <inc/shell.h>
 #include <inc/timer.h>
+#include <inc/boot.h>
+#include <inc/kbd.h>
+#include <kernel/pmap.h>
+#include <kernel/restart.h>
+#include <kernel/trap.h>
+#include <kernel/irq.h>
+#include <kernel/ktimer.h>
+#include <kernel/softirq.h>
+#include <kernel/syscall.h>
 
 struct Command {
 	const char *name;
@@ -14,7 +23,19 @@ static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
 	{ "print_tick", "Display system tick", print_tick },
-	{ "chgcolor", "Display system tick", chgcolor }
+	{ "chgcolor", "Display system tick", chgcolor },
+	{ "boottime", "Display time spent in each boot phase", mon_boottime },
+	{ "meminfo", "Display the memory map and free/used page frames", mon_meminfo },
+	{ "restart", "Restart the kernel in memory ('restart cold' to reset through the BIOS)", mon_restart },
+	{ "traplat", "Display trap latencies ('traplat <vector>' for a histogram, 'traplat reset')", mon_traplat },
+	{ "clock", "Display the TSC clocksource and its drift against jiffies", mon_clock },
+	{ "timers", "Display timer wheel statistics ('timers bench [n]' to stress it)", mon_timers },
+	{ "tickless", "Display idle wakeups ('tickless on|off' to switch dynamic ticks)", mon_tickless },
+	{ "irqstat", "Display the interrupt controller, softirqs, trap counts and handlers", mon_irqstat },
+	{ "syscall", "Time null system calls from user mode, int vs sysenter ('syscall [n]')", mon_syscall },
+	{ "kbdstat", "Display keyboard queue drops and input latency ('kbdstat reset' to clear)", mon_kbdstat },
+	{ "vgastat", "Display how much of the VGA console output reached video memory", mon_vgastat },
+	{ "printbench", "Time cprintf with and without its buffer ('printbench [n]')", mon_printbench }
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
@@ -42,6 +63,7 @@ extern unsigned long kernel_load_addr;
 extern unsigned long kernel_code_end;
 extern unsigned long kernel_data_start;
 extern unsigned long kernel_end;
+extern char edata[], end[];
 
 int mon_kerninfo(int argc, char **argv)
 {
@@ -60,6 +82,8 @@ int mon_kerninfo(int argc, char **argv)
 	cprintf("Kernel data base start=0x%x", &kernel_data_start);
 	cprintf(" size = %d\n", kernel_data_size);
 	cprintf("Kernel executable memory footprint: %dKB\n", kernel_exec_size/1024);
+	cprintf("Kernel image: %d bytes read from disk, %d bytes of .bss zeroed\n",
+		edata - (char *) &kernel_load_addr, end - edata);
 	return 0;
 }
 
@@ -68,6 +92,144 @@ int print_tick(int argc, char **argv)
 	cprintf("Now tick = %d\n", get_tick());
 }
 
+int mon_boottime(int argc, char **argv)
+{
+	unsigned long khz = tsc_khz();
+	uint64_t prev = 0, t, cycles;
+	int i;
+
+	cprintf("TSC %lu kHz\n", khz);
+	for (i = 0; i < BT_NPHASE; i++) {
+		t = boottime_tsc(i);
+		/* Stamps left by another loader, or none at all */
+		if (t <= prev) {
+			cprintf("%-30s        n/a\n", boottime_name(i));
+			continue;
+		}
+		cycles = t - prev;
+		cprintf("%-30s %10llu cycles %8llu us\n", boottime_name(i),
+			cycles, cycles * 1000 / khz);
+		prev = t;
+	}
+	return 0;
+}
+
+int mon_meminfo(int argc, char **argv)
+{
+	size_t nfree = page_nfree();
+
+	print_e820();
+	cprintf("Page frames: %d total, %d free, %d used (%dKB free)\n",
+		npages, nfree, npages - nfree, nfree * (PGSIZE / 1024));
+	return 0;
+}
+
+int mon_restart(int argc, char **argv)
+{
+	if (argc > 1 && strcmp(argv[1], "cold") == 0)
+		cold_reboot();
+	cprintf("Restarting!\n");
+	warm_restart();
+}
+
+int mon_traplat(int argc, char **argv)
+{
+	char *end;
+	long vec = -1;
+
+	if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+		trap_latency_reset();
+		cprintf("Trap latencies reset\n");
+		return 0;
+	}
+	if (argc > 1) {
+		vec = strtol(argv[1], &end, 0);
+		if (*end != '\0' || vec < 0 || vec > 255) {
+			cprintf("Not a vector: %s\n", argv[1]);
+			return 0;
+		}
+	}
+	trap_latency_print(vec);
+	return 0;
+}
+
+int mon_clock(int argc, char **argv)
+{
+	clock_print();
+	return 0;
+}
+
+int mon_timers(int argc, char **argv)
+{
+	int n = 20000;
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		if (argc > 2)
+			n = strtol(argv[2], 0, 0);
+		if (ktimer_bench(n) < 0)
+			cprintf("Cannot allocate %d timers\n", n);
+	} else
+		ktimer_print();
+	return 0;
+}
+
+int mon_tickless(int argc, char **argv)
+{
+	if (argc > 1)
+		timer_dynticks(strcmp(argv[1], "off") != 0);
+	timer_print_idle();
+	return 0;
+}
+
+int mon_irqstat(int argc, char **argv)
+{
+	irq_print();
+	softirq_print();
+	trap_print_stats();
+	return 0;
+}
+
+int mon_syscall(int argc, char **argv)
+{
+	int n = 100000;
+
+	if (argc > 1)
+		n = strtol(argv[1], 0, 0);
+	if (n < 1 || n > 1000000)
+		cprintf("Iterations must be between 1 and 1000000\n");
+	else if (syscall_bench(n) < 0)
+		cprintf("Cannot set up the user pages\n");
+	return 0;
+}
+
+int mon_kbdstat(int argc, char **argv)
+{
+	if (argc > 1 && strcmp(argv[1], "reset") == 0)
+		kbd_reset_stats();
+	else
+		kbd_print();
+	return 0;
+}
+
+int mon_vgastat(int argc, char **argv)
+{
+	screen_print_stats();
+	return 0;
+}
+
+int mon_printbench(int argc, char **argv)
+{
+	int n = 1000;
+
+	if (argc > 1)
+		n = strtol(argv[1], 0, 0);
+	if (n < 1)
+		cprintf("Need at least one line\n");
+	else
+		cprintf_bench(n);
+	return 0;
+}
+
 #define WHITESPACE "\t\r\n "
 #define MAXARGS 16
 
@@ -113,6 +275,7 @@ void shell()
 	char *buf;
 	cprintf("Welcome to the OSDI course!\n");
 	cprintf("Type 'help' for a list of commands.\n");
+	boottime_stamp(BT_SHELL);
 
 	while(1)
 	{
@@ -0,0 +1,135 @@
+/*
+ * Softirqs and tasklets: the bottom halves of interrupt handling.
+ *
+ * An interrupt handler does what cannot wait, with interrupts off, and
+ * raises a softirq for the rest.  default_trap_handler() calls
+ * do_softirq() on the way out of every outermost trap that interrupted
+ * code with interrupts enabled; it runs the raised softirqs with
+ * interrupts back on, so other IRQs are only held off for the top
+ * halves.  Softirqs never nest: one raised while they run is picked up
+ * by the running do_softirq() before it returns.
+ */
+#include <inc/stdio.h>
+#include <inc/x86.h>
+#include <kernel/ktimer.h>
+#include <kernel/softirq.h>
+
+// Rounds of newly raised softirqs do_softirq() runs before it leaves
+// the rest to the next trap exit
+#define MAX_RESTART	10
+
+static void tasklet_action(void);
+
+static struct {
+	void (*func)(void);
+	const char *name;
+	unsigned long raised;
+	unsigned long runs;
+} softirqs[NSOFTIRQ] = {
+	[SOFTIRQ_TIMER]		= { ktimer_run, "timer" },
+	[SOFTIRQ_TASKLET]	= { tasklet_action, "tasklet" },
+};
+
+static volatile uint32_t softirq_pending;
+static bool in_softirq;
+static unsigned long deferred;	// times MAX_RESTART ran out
+
+static struct Tasklet *tasklet_head, **tasklet_tail = &tasklet_head;
+
+// Mark softirq 'nr' pending.  Callable from any context.
+void
+softirq_raise(int nr)
+{
+	uint32_t eflags = read_eflags();
+
+	__asm __volatile("cli");
+	softirq_pending |= 1 << nr;
+	softirqs[nr].raised++;
+	write_eflags(eflags);
+}
+
+// Run pending softirqs.  Called with interrupts off; they are on while
+// the handlers run and off again on return.
+void
+do_softirq(void)
+{
+	uint32_t pending;
+	int nr, restart;
+
+	if (in_softirq)
+		return;
+	in_softirq = 1;
+	for (restart = 0; (pending = softirq_pending); restart++) {
+		if (restart == MAX_RESTART) {
+			deferred++;
+			break;
+		}
+		softirq_pending = 0;
+		__asm __volatile("sti");
+		for (; pending; pending &= pending - 1) {
+			nr = __builtin_ctz(pending);
+			softirqs[nr].runs++;
+			softirqs[nr].func();
+		}
+		__asm __volatile("cli");
+	}
+	in_softirq = 0;
+}
+
+void
+tasklet_init(struct Tasklet *t, void (*func)(void *), void *arg)
+{
+	t->t_next = NULL;
+	t->t_func = func;
+	t->t_arg = arg;
+	t->t_scheduled = 0;
+}
+
+// Queue 't' to run from the tasklet softirq, unless it already is
+void
+tasklet_schedule(struct Tasklet *t)
+{
+	uint32_t eflags = read_eflags();
+
+	__asm __volatile("cli");
+	if (!t->t_scheduled) {
+		t->t_scheduled = 1;
+		t->t_next = NULL;
+		*tasklet_tail = t;
+		tasklet_tail = &t->t_next;
+		softirq_raise(SOFTIRQ_TASKLET);
+	}
+	write_eflags(eflags);
+}
+
+// Run the tasklets scheduled so far, in order
+static void
+tasklet_action(void)
+{
+	struct Tasklet *t, *list;
+
+	__asm __volatile("cli");
+	list = tasklet_head;
+	tasklet_head = NULL;
+	tasklet_tail = &tasklet_head;
+	__asm __volatile("sti");
+
+	while ((t = list)) {
+		list = t->t_next;
+		// may be scheduled again from here on
+		t->t_scheduled = 0;
+		t->t_func(t->t_arg);
+	}
+}
+
+void
+softirq_print(void)
+{
+	int i;
+
+	for (i = 0; i < NSOFTIRQ; i++)
+		cprintf("softirq %-8s raised %lu, ran %lu\n", softirqs[i].name,
+			softirqs[i].raised, softirqs[i].runs);
+	if (deferred)
+		cprintf("softirqs left for a later trap %lu times\n", deferred);
+}
@@ -0,0 +1,31 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SOFTIRQ_H
+#define JOS_KERN_SOFTIRQ_H
+
+#include <inc/types.h>
+
+// Softirq types, in the order do_softirq() runs them
+enum {
+	SOFTIRQ_TIMER,		// turn the timer wheel (ktimer_run)
+	SOFTIRQ_TASKLET,	// run scheduled tasklets
+	NSOFTIRQ
+};
+
+// A tasklet: a function an interrupt handler schedules to run later,
+// once per scheduling however often that happens meanwhile.
+struct Tasklet {
+	struct Tasklet *t_next;
+	void (*t_func)(void *arg);
+	void *t_arg;
+	bool t_scheduled;
+};
+
+void softirq_raise(int nr);
+void do_softirq(void);
+void softirq_print(void);
+
+void tasklet_init(struct Tasklet *t, void (*func)(void *), void *arg);
+void tasklet_schedule(struct Tasklet *t);
+
+#endif /* !JOS_KERN_SOFTIRQ_H */
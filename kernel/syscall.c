@@ -0,0 +1,157 @@
+/*
+ * System calls.
+ *
+ * User mode gets into syscall() two ways: the int $T_SYSCALL gate,
+ * whose handler runs on the trap frame like any other, and SYSENTER,
+ * which skips the IDT and the frame and lands in sysenter_handler
+ * (syscall_entry.S).  Both enter on syscall_stack, since the kernel
+ * stack proper is still in use under user_enter().  The calls
+ * themselves are a table indexed by number.
+ */
+#include <inc/stdio.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/timer.h>
+#include <inc/x86.h>
+#include <kernel/pmap.h>
+#include <kernel/trap.h>
+#include <kernel/syscall.h>
+
+// Where syscall_bench() puts its code and stack
+#define UBENCH_TEXT	0x00800000
+#define UBENCH_STACK	(UBENCH_TEXT + PGSIZE)
+
+#define CPUID_SEP	(1 << 11)	// SYSENTER/SYSEXIT, in CPUID 1 %edx
+
+typedef int32_t (*syscall_t)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+
+extern void sysenter_handler(void);
+extern int user_enter(uintptr_t eip, uintptr_t esp, uint32_t arg);
+extern void user_return(int ret) __attribute__((noreturn));
+extern char ubench_start[], ubench_int[], ubench_sysenter[], ubench_end[];
+
+static uint8_t syscall_stack[KSTKSIZE] __attribute__((aligned(PGSIZE)));
+static bool have_sysenter;
+static bool ubench_mapped;
+
+static int32_t
+sys_null(void)
+{
+	return 0;
+}
+
+static int32_t
+sys_exit(uint32_t ret)
+{
+	user_return(ret);
+}
+
+static int32_t
+sys_gettick(void)
+{
+	return get_tick();
+}
+
+static const syscall_t syscalls[NSYSCALLS] = {
+	[SYS_null]	= (syscall_t) sys_null,
+	[SYS_exit]	= (syscall_t) sys_exit,
+	[SYS_gettick]	= (syscall_t) sys_gettick,
+};
+
+// Dispatch system call 'no'.  Returns its result, or -E_INVAL.
+int32_t
+syscall(uint32_t no, uint32_t a1, uint32_t a2, uint32_t a3,
+	uint32_t a4, uint32_t a5)
+{
+	if (no >= NSYSCALLS || syscalls[no] == NULL)
+		return -E_INVAL;
+	return syscalls[no](a1, a2, a3, a4, a5);
+}
+
+static void
+syscall_trap(struct Trapframe *tf, void *arg)
+{
+	struct PushRegs *r = &tf->tf_regs;
+
+	r->reg_eax = syscall(r->reg_eax, r->reg_edx, r->reg_ecx,
+			     r->reg_ebx, r->reg_edi, r->reg_esi);
+}
+
+void
+syscall_init(void)
+{
+	uint32_t eax, edx;
+	uintptr_t top = (uintptr_t) syscall_stack + KSTKSIZE;
+
+	ts.ts_esp0 = top;
+	trap_register(T_SYSCALL, syscall_trap, NULL, "syscall");
+
+	// The Pentium Pro claims SEP but does not have it
+	cpuid(1, &eax, NULL, NULL, &edx);
+	have_sysenter = (edx & CPUID_SEP) &&
+		!(((eax >> 8) & 0xF) == 6 && ((eax >> 4) & 0xF) < 3 &&
+		  (eax & 0xF) < 3);
+	if (!have_sysenter)
+		return;
+	wrmsr(MSR_IA32_SYSENTER_CS, GD_KT);
+	wrmsr(MSR_IA32_SYSENTER_ESP, top);
+	wrmsr(MSR_IA32_SYSENTER_EIP, (uintptr_t) sysenter_handler);
+}
+
+// Give the benchmark code a user page of its own, and a stack
+static int
+ubench_map(void)
+{
+	physaddr_t text, stack;
+	int r;
+
+	if (ubench_mapped)
+		return 0;
+	if ((r = page_alloc(&text)) < 0)
+		return r;
+	if ((r = page_alloc(&stack)) < 0) {
+		page_free(text);
+		return r;
+	}
+	memcpy(KADDR(text), ubench_start, ubench_end - ubench_start);
+	if ((r = page_map_user(UBENCH_TEXT, text)) < 0 ||
+	    (r = page_map_user(UBENCH_STACK, stack)) < 0) {
+		page_free(text);
+		page_free(stack);
+		return r;
+	}
+	ubench_mapped = 1;
+	return 0;
+}
+
+// Cycles per null system call made from user mode with 'entry'
+static uint32_t
+ubench_run(char *entry, int n)
+{
+	uintptr_t eip = UBENCH_TEXT + (entry - ubench_start);
+
+	// once to warm the caches and TLB
+	user_enter(eip, UBENCH_STACK + PGSIZE, 1);
+	return user_enter(eip, UBENCH_STACK + PGSIZE, n) / n;
+}
+
+/*
+ * Time 'n' null system calls from user mode through each entry path.
+ * Returns 0, or an error if the user pages cannot be set up.
+ */
+int
+syscall_bench(int n)
+{
+	int r;
+
+	if ((r = ubench_map()) < 0)
+		return r;
+	cprintf("int $0x%x: %u cycles per null system call\n",
+		T_SYSCALL, ubench_run(ubench_int, n));
+	if (have_sysenter)
+		cprintf("sysenter: %u cycles per null system call\n",
+			ubench_run(ubench_sysenter, n));
+	else
+		cprintf("sysenter: not supported by this CPU\n");
+	return 0;
+}
@@ -0,0 +1,14 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SYSCALL_H
+#define JOS_KERN_SYSCALL_H
+
+#include <inc/types.h>
+#include <inc/syscall.h>
+
+void syscall_init(void);
+int32_t syscall(uint32_t no, uint32_t a1, uint32_t a2, uint32_t a3,
+		uint32_t a4, uint32_t a5);
+int syscall_bench(int n);
+
+#endif /* !JOS_KERN_SYSCALL_H */
@@ -1,38 +1,156 @@
 /* Reference: http://www.osdever.net/bkerndev/Docs/pit.htm */
 #include <kernel/trap.h>
-#include <kernel/picirq.h>
+#include <kernel/irq.h>
 #include <inc/mmu.h>
 #include <inc/x86.h>
+#include <inc/stdio.h>
+#include <inc/timer.h>
+#include <kernel/ktimer.h>
+#include <kernel/softirq.h>
 
-#define TIME_HZ 100
+#define PIT_DIVISOR	(PIT_HZ / TIME_HZ)	/* PIT counts per tick */
+/* Longest the one-shot PIT can sleep, in whole ticks */
+#define IDLE_MAXTICKS	(0xFFFF / PIT_DIVISOR)
 
-static unsigned long jiffies = 0;
+static volatile unsigned long jiffies = 0;
+
+/*
+ * Dynamic ticks.  While busy, the PIT interrupts every tick (mode 2).
+ * timer_idle() instead programs it to interrupt once (mode 0), on the
+ * tick boundary of the next pending event, and halts; jiffies catches
+ * up on the ticks slept through when the CPU wakes, and the PIT goes
+ * back to periodic mode from the next tick boundary.  While the CPU
+ * sleeps, jiffies lags behind by the ticks not yet accounted for.
+ */
+static bool dynticks = 1;
+static bool oneshot;			/* PIT is in mode 0 */
+static unsigned long oneshot_ticks;	/* ticks until it fires */
+static unsigned long nwakeups, nticks, stat_start;
 
 void set_timer(int hz)
 {
-    int divisor = 1193180 / hz;       /* Calculate our divisor */
-    outb(0x43, 0x36);             /* Set our command byte 0x36 */
+    int divisor = PIT_HZ / hz;       /* Calculate our divisor */
+    outb(0x43, 0x34);             /* Set our command byte 0x34, rate generator */
     outb(0x40, divisor & 0xFF);   /* Set low byte of divisor */
     outb(0x40, divisor >> 8);     /* Set high byte of divisor */
 }
 
+/* Interrupt once, 'count' PIT cycles from now */
+static void pit_oneshot(uint16_t count)
+{
+	outb(0x43, 0x30);
+	outb(0x40, count & 0xFF);
+	outb(0x40, count >> 8);
+}
+
+/* Counts left in the current period */
+static uint16_t pit_count()
+{
+	uint16_t lo;
+
+	outb(0x43, 0x00);		/* latch channel 0 */
+	lo = inb(0x40);
+	return lo | inb(0x40) << 8;
+}
+
+/* Whether a mode 0 count has run out, from the channel 0 OUT pin */
+static bool pit_expired()
+{
+	outb(0x43, 0xE2);		/* read back status of channel 0 */
+	return inb(0x40) & 0x80;
+}
+
 /* 
  * Timer interrupt handler
  */
-void timer_handler()
+void timer_handler(struct Trapframe *tf, void *arg)
+{
+	nticks++;
+	softirq_raise(SOFTIRQ_TIMER);
+	/* The one-shot may have been programmed with a periodic tick
+	 * still pending; only a count that ran out ends it */
+	if (oneshot && pit_expired()) {
+		jiffies += oneshot_ticks;
+		oneshot = 0;
+		set_timer(TIME_HZ);
+	} else
+		jiffies++;
+}
+
+/*
+ * The tick of the earliest pending event: the next kernel timer, as
+ * far as the PIT can sleep.
+ */
+static unsigned long next_event()
 {
-	jiffies++;
+	return ktimer_next(IDLE_MAXTICKS);
+}
+
+/*
+ * Wait for an interrupt.  Called with interrupts disabled, after the
+ * caller made sure it has nothing to do; returns with them enabled.
+ */
+void timer_idle()
+{
+	unsigned long ticks = next_event() - jiffies;
+	uint16_t rem;
+	unsigned long left;
+
+	if (dynticks && !oneshot && (long) ticks >= 2) {
+		if (ticks > IDLE_MAXTICKS)
+			ticks = IDLE_MAXTICKS;
+		/* end on a tick boundary, ticks - 1 periods after this one */
+		pit_oneshot(pit_count() + (ticks - 1) * PIT_DIVISOR);
+		oneshot = 1;
+		oneshot_ticks = ticks;
+	}
+
+	__asm __volatile("sti; hlt; cli");
+	nwakeups++;
+
+	/* Some other interrupt woke us: count the ticks slept through,
+	 * and end the one-shot on the next tick boundary instead */
+	if (oneshot && !pit_expired()) {
+		rem = pit_count();
+		left = (rem + PIT_DIVISOR - 1) / PIT_DIVISOR;
+		jiffies += oneshot_ticks - left;
+		if (left > 1)
+			pit_oneshot(rem - (left - 1) * PIT_DIVISOR);
+		oneshot_ticks = 1;
+	}
+	__asm __volatile("sti");
+}
+
+void timer_dynticks(int on)
+{
+	dynticks = on;
+	nwakeups = nticks = 0;
+	stat_start = jiffies;
+}
+
+void timer_print_idle()
+{
+	unsigned long t = jiffies - stat_start;
+
+	cprintf("Dynamic ticks %s; in %lu.%02lu s: %lu wakeups, %lu timer interrupts",
+		dynticks ? "on" : "off", t / TIME_HZ, t % TIME_HZ,
+		nwakeups, nticks);
+	if (t >= TIME_HZ)
+		cprintf(", %lu wakeups/s", nwakeups * TIME_HZ / t);
+	cprintf("\n");
 }
 
 unsigned long get_tick()
 {
 	return jiffies;
 }
+
 void timer_init()
 {
 	set_timer(TIME_HZ);
+	trap_register(irq_to_vector(IRQ_TIMER), timer_handler, NULL, "timer");
 
 	/* Enable interrupt */
-	irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_TIMER));
+	irq_enable(IRQ_TIMER);
 }
 
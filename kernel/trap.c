@@ -3,14 +3,56 @@
 #include <inc/x86.h>
 #include <inc/kbd.h>
 #include <inc/timer.h>
+#include <inc/stdio.h>
+#include <inc/error.h>
+#include <kernel/irq.h>
+#include <kernel/softirq.h>
 
 /* For debugging, so print_trapframe can distinguish between printing
  * a saved trapframe and printing the current trapframe and print some
  * additional information in the latter case.
  */
 static struct Trapframe *last_tf;
-extern void irq_timer();
-extern void irq_kbd();
+extern uint32_t trap_vectors[];	// entry points, from trap_entry.S
+
+/*
+ * Handlers, by vector.  Each vector has a chain of handlers so devices
+ * can share an IRQ line; trap_dispatch() indexes trap_handlers and runs
+ * the whole chain.  Chain links come from a fixed pool.
+ */
+#define NHANDLERS	64
+
+struct TrapHandler {
+	trap_handler_t th_func;
+	void *th_arg;
+	const char *th_name;
+	struct TrapHandler *th_next;
+};
+
+static struct TrapHandler *trap_handlers[256];
+static struct TrapHandler handler_pool[NHANDLERS];
+static struct TrapHandler *handler_free;
+
+static uint32_t trap_count[256];	// traps through each vector
+static uint32_t trap_unknown[256];	// ... with no handler registered
+static bool trap_replay;		// the next trap is from trap_resend()
+
+/*
+ * Nesting.  IRQ handlers run with interrupts enabled, so an interrupt
+ * the controller ranks higher can preempt them: IRQ 0 before 1 before
+ * the slave's 8-15 before 3-7 on the 8259A (normal, fully nested EOI),
+ * vector / 16 on the local APIC.  The IRQ in service holds off equal
+ * and lower ones until trap_dispatch() sends its EOI.
+ *
+ * _alltraps counts trap_depth and moves the outermost trap onto
+ * intrstack; softirqs only run on the way out of that one.
+ */
+#define STACK_POISON	0xCAFEBABE
+#define MAXDEPTH	8
+
+int trap_depth;				// traps in progress
+extern uint32_t intrstack[], intrstacktop[];
+static uint32_t depth_count[MAXDEPTH];	// traps taken at each depth
 
 /* TODO: You should declare an interrupt descriptor table.
  *       In x86, there are at most 256 it.
@@ -22,8 +64,30 @@ extern void irq_kbd();
 struct Gatedesc idt[256];
 struct Pseudodesc idt_pd; 
 
+/*
+ * The kernel's own GDT, replacing the boot loader's: the same kernel
+ * segments, plus user segments and the TSS that trap entry from user
+ * mode needs.  SYSENTER relies on the order GD_KT, GD_KD, GD_UT, GD_UD.
+ */
+struct Segdesc gdt[] =
+{
+	SEG_NULL,
+	[GD_KT >> 3] = SEG(STA_X | STA_R, 0x0, 0xffffffff, 0),
+	[GD_KD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 0),
+	[GD_UT >> 3] = SEG(STA_X | STA_R, 0x0, 0xffffffff, 3),
+	[GD_UD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 3),
+	[GD_TSS0 >> 3] = SEG_NULL
+};
+
+struct Pseudodesc gdt_pd = {
+	sizeof(gdt) - 1, (unsigned long) gdt
+};
+
+// Its ts_esp0 is the stack traps from user mode switch to
+struct Taskstate ts;
+
 /* For debugging */
-static const char *trapname(int trapno)
+const char *trapname(int trapno)
 {
 	static const char * const excnames[] = {
 		"Divide error",
@@ -122,17 +186,164 @@ trap_dispatch(struct Trapframe *tf)
    *       We prepared the keyboard handler and timer handler for you
    *       already. Please reference in kernel/kbd.c and kernel/timer.c
    */
-	switch(tf->tf_trapno){     
-		case IRQ_OFFSET + IRQ_TIMER:
-			timer_handler();
-			break;
-		case IRQ_OFFSET + IRQ_KBD:
-			kbd_intr();
-			break;    
-		default:
-			// Unexpected trap: The user process or the kernel has a bug.
+	struct TrapHandler *th;
+	uint32_t trapno = tf->tf_trapno & 0xFF;
+	bool replay = trap_replay;
+
+	// A replayed IRQ was counted when it first arrived, and is no
+	// longer in service with the interrupt controller
+	trap_replay = 0;
+	depth_count[(trap_depth < MAXDEPTH ? trap_depth : MAXDEPTH) - 1]++;
+	if (!replay) {
+		trap_count[trapno]++;
+		if (irq_spurious(trapno) || irq_lazy_disabled(trapno))
+			return;
+	}
+	th = trap_handlers[trapno];
+	if (th == NULL) {
+		trap_unknown[trapno]++;
+		// Returning from an unhandled exception would just fault
+		// again: the kernel has a bug.
+		if (trapno < IRQ_OFFSET) {
 			print_trapframe(tf);
+			while (1)
+				/* do nothing */;
+		}
 	}
+	// Let higher-priority IRQs in while this one's handlers run
+	if (irq_is_device(trapno))
+		__asm __volatile("sti");
+	for (; th != NULL; th = th->th_next)
+		th->th_func(tf, th->th_arg);
+	__asm __volatile("cli");
+	if (!replay)
+		irq_eoi(trapno);
+}
+
+/*
+ * Add 'func' to the handlers of vector 'trapno'; it is called with the
+ * trap frame and 'arg'.  Handlers on a shared vector run in the order
+ * they were registered.
+ * Returns 0, -E_INVAL for a bad vector, or -E_NO_MEM.
+ */
+int
+trap_register(int trapno, trap_handler_t func, void *arg, const char *name)
+{
+	struct TrapHandler *th, **pp;
+	uint32_t eflags;
+
+	if (trapno < 0 || trapno >= 256 || func == NULL)
+		return -E_INVAL;
+	if ((th = handler_free) == NULL)
+		return -E_NO_MEM;
+	handler_free = th->th_next;
+	th->th_func = func;
+	th->th_arg = arg;
+	th->th_name = name;
+	th->th_next = NULL;
+
+	// the chain may be running on this very vector
+	eflags = read_eflags();
+	__asm __volatile("cli");
+	for (pp = &trap_handlers[trapno]; *pp; pp = &(*pp)->th_next)
+		/* do nothing */;
+	*pp = th;
+	write_eflags(eflags);
+	return 0;
+}
+
+// Whether anything is registered on vector 'trapno'
+bool
+trap_has_handlers(int trapno)
+{
+	if (trapno < 0 || trapno >= 256)
+		return 0;
+	return trap_handlers[trapno] != NULL;
+}
+
+/*
+ * Remove the handler registered with this 'func' and 'arg'.
+ * Returns 0, or -E_INVAL if there is none.
+ */
+int
+trap_unregister(int trapno, trap_handler_t func, void *arg)
+{
+	struct TrapHandler *th, **pp;
+	uint32_t eflags;
+
+	if (trapno < 0 || trapno >= 256)
+		return -E_INVAL;
+	eflags = read_eflags();
+	__asm __volatile("cli");
+	for (pp = &trap_handlers[trapno]; (th = *pp); pp = &th->th_next)
+		if (th->th_func == func && th->th_arg == arg) {
+			*pp = th->th_next;
+			th->th_next = handler_free;
+			handler_free = th;
+			break;
+		}
+	write_eflags(eflags);
+	return th ? 0 : -E_INVAL;
+}
+
+/*
+ * Take vector 'trapno' again, as if the hardware had raised it: build
+ * the frame an interrupt gate would and enter its stub.  For IRQs that
+ * arrived while they were disabled.
+ */
+void
+trap_resend(int trapno)
+{
+	uint32_t eflags = read_eflags();
+
+	// Nothing can trap in between, so trap_dispatch() finds this set
+	// for the very trap we raise
+	__asm __volatile("cli");
+	trap_replay = 1;
+	__asm __volatile("pushl %1\n\t"
+			 "pushl %%cs\n\t"
+			 "call *%0"
+			 : : "r" (trap_vectors[trapno & 0xFF]), "r" (eflags)
+			 : "memory", "cc");
+}
+
+// List the vectors that have trapped or have handlers
+void
+trap_print_stats(void)
+{
+	struct TrapHandler *th;
+	int i;
+
+	cprintf("vec %-22s %10s %10s  handlers\n", "", "count", "unknown");
+	for (i = 0; i < 256; i++) {
+		if (trap_count[i] == 0 && trap_handlers[i] == NULL)
+			continue;
+		cprintf("%3d %-22s %10u %10u ", i, trapname(i),
+			trap_count[i], trap_unknown[i]);
+		for (th = trap_handlers[i]; th; th = th->th_next)
+			cprintf(" %s", th->th_name);
+		cprintf("\n");
+	}
+	trap_print_nesting();
+}
+
+// Traps by nesting depth, and how deep intrstack has ever been used
+void
+trap_print_nesting(void)
+{
+	uint32_t *p;
+	int i;
+
+	cprintf("traps by nesting depth:");
+	for (i = 0; i < MAXDEPTH; i++)
+		if (depth_count[i])
+			cprintf(" %d%s: %u", i + 1, i == MAXDEPTH - 1 ? "+" : "",
+				depth_count[i]);
+	cprintf("\n");
+	for (p = intrstack; p < intrstacktop && *p == STACK_POISON; p++)
+		/* do nothing */;
+	cprintf("interrupt stack: %u of %u bytes used at most\n",
+		(intrstacktop - p) * sizeof(*p), KSTKSIZE);
 }
 
 /* 
@@ -146,6 +357,11 @@ void default_trap_handler(struct Trapframe *tf)
 
 	// Dispatch based on what type of trap occurred
 	trap_dispatch(tf);
+
+	// Bottom halves, unless we interrupted code that had interrupts
+	// off for a reason, or another trap that will run them itself
+	if (trap_depth == 1 && (tf->tf_eflags & FL_IF))
+		do_softirq();
 }
 
 void trap_init()
@@ -172,16 +388,50 @@ void trap_init()
    *       come in handy for you when filling up the argument of "lidt"
    */
 
-	/* Keyboard interrupt setup */
-	kbd_init();
-	timer_init();
-	/* Timer Trap setup */
-  /* Load IDT */
-  SETGATE(idt[IRQ_OFFSET + IRQ_TIMER], 0, GD_KT, irq_timer, 0);
-  SETGATE(idt[IRQ_OFFSET + IRQ_KBD], 0, GD_KT, irq_kbd, 0);
+	int i;
+
+	/* Every vector gets a gate; drivers then claim theirs with
+	 * trap_register() when kernel_main() brings them up */
+	for (i = 0; i < 256; i++)
+		SETGATE(idt[i], 0, GD_KT, trap_vectors[i], 0);
+	// the one gate user mode may use
+	SETGATE(idt[T_SYSCALL], 0, GD_KT, trap_vectors[T_SYSCALL], 3);
+
+	// for trap_print_nesting()'s high-water mark
+	for (i = 0; i < KSTKSIZE / sizeof(uint32_t); i++)
+		intrstack[i] = STACK_POISON;
+
+	for (i = 0; i < NHANDLERS; i++) {
+		handler_pool[i].th_next = handler_free;
+		handler_free = &handler_pool[i];
+	}
 
 	idt_pd.pd_lim = (sizeof(struct Gatedesc) * 256) - 1;
 	idt_pd.pd_base = (uint32_t) &idt;
 
 	lidt(&idt_pd);     
+
+	trap_init_percpu();
+}
+
+// Load the kernel GDT and the TSS
+void
+trap_init_percpu(void)
+{
+	lgdt(&gdt_pd);
+	__asm __volatile("movw %%ax,%%gs" : : "a" (GD_UD|3));
+	__asm __volatile("movw %%ax,%%fs" : : "a" (GD_UD|3));
+	__asm __volatile("movw %%ax,%%es" : : "a" (GD_KD));
+	__asm __volatile("movw %%ax,%%ds" : : "a" (GD_KD));
+	__asm __volatile("movw %%ax,%%ss" : : "a" (GD_KD));
+	// reload cs
+	__asm __volatile("ljmp %0,$1f\n 1:\n" : : "i" (GD_KT));
+	lldt(0);
+
+	ts.ts_ss0 = GD_KD;
+	ts.ts_iomb = sizeof(struct Taskstate);
+	gdt[GD_TSS0 >> 3] = SEG16(STS_T32A, (uint32_t) (&ts),
+				  sizeof(struct Taskstate) - 1, 0);
+	gdt[GD_TSS0 >> 3].sd_s = 0;
+	ltr(GD_TSS0);
 }
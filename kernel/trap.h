@@ -9,12 +9,26 @@
 /* The kernel's interrupt descriptor table */
 extern struct Gatedesc idt[];
 extern struct Pseudodesc idt_pd;
+extern struct Taskstate ts;
+
+typedef void (*trap_handler_t)(struct Trapframe *tf, void *arg);
 
 void trap_init(void);
-//void trap_init_percpu(void);
+int trap_register(int trapno, trap_handler_t func, void *arg, const char *name);
+int trap_unregister(int trapno, trap_handler_t func, void *arg);
+bool trap_has_handlers(int trapno);
+void trap_resend(int trapno);
+void trap_print_stats(void);
+void trap_print_nesting(void);
+void trap_init_percpu(void);
 void print_regs(struct PushRegs *regs);
 void print_trapframe(struct Trapframe *tf);
+const char *trapname(int trapno);
 //void page_fault_handler(struct Trapframe *);
 void backtrace(struct Trapframe *);
 
+void trap_latency_record(struct Trapframe *tf, uint64_t t0);
+void trap_latency_reset(void);
+void trap_latency_print(int vec);
+
 #endif /* JOS_KERN_TRAP_H */
@@ -0,0 +1,125 @@
+/*
+ * Trap latency histograms.
+ *
+ * With TRAP_LATENCY defined, _alltraps (trap_entry.S) reads the TSC
+ * once the trap frame is built and hands it to trap_latency_record()
+ * after default_trap_handler() returns, so every trap is timed from
+ * entry to exit, handler included.  Each vector keeps a log2 histogram
+ * of the cycle counts along with count, min, max and sum, which is
+ * enough for the mean and a bucket-precision p99.
+ */
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/timer.h>
+#include <inc/x86.h>
+#include <kernel/trap.h>
+
+#define NVECTORS	256
+#define NBUCKETS	32	// bucket b counts latencies in [2^b, 2^(b+1))
+
+struct TrapLatency {
+	uint32_t tl_count;
+	uint32_t tl_min;
+	uint32_t tl_max;
+	uint64_t tl_sum;
+	uint32_t tl_hist[NBUCKETS];
+};
+
+static struct TrapLatency traplat[NVECTORS];
+
+// Whether _alltraps stamps traps at all
+#ifdef TRAP_LATENCY
+static const bool traplat_built = 1;
+#else
+static const bool traplat_built = 0;
+#endif
+
+// Called from _alltraps with interrupts off, t0 being the entry stamp
+void
+trap_latency_record(struct Trapframe *tf, uint64_t t0)
+{
+	struct TrapLatency *tl = &traplat[tf->tf_trapno % NVECTORS];
+	uint64_t d64 = read_tsc() - t0;
+	uint32_t d = d64 > ~0U ? ~0U : d64;
+
+	if (tl->tl_count == 0 || d < tl->tl_min)
+		tl->tl_min = d;
+	if (d > tl->tl_max)
+		tl->tl_max = d;
+	tl->tl_count++;
+	tl->tl_sum += d;
+	tl->tl_hist[d ? 31 - __builtin_clz(d) : 0]++;
+}
+
+void
+trap_latency_reset(void)
+{
+	__asm __volatile("cli");
+	memset(traplat, 0, sizeof(traplat));
+	__asm __volatile("sti");
+}
+
+// Upper bound of the bucket holding the 99th percentile
+static uint32_t
+p99(struct TrapLatency *tl)
+{
+	uint32_t want = tl->tl_count - tl->tl_count / 100, seen = 0;
+	int b;
+
+	for (b = 0; b < NBUCKETS - 1; b++)
+		if ((seen += tl->tl_hist[b]) >= want)
+			break;
+	return b == NBUCKETS - 1 ? ~0U : (2U << b) - 1;
+}
+
+// Print the summary of every vector that trapped, or with vec >= 0, the
+// histogram of that vector.
+void
+trap_latency_print(int vec)
+{
+	struct TrapLatency *tl, snap;
+	unsigned long khz;
+	int v, b;
+
+	if (!traplat_built) {
+		cprintf("Trap latency stamps are not built in (make TRAP_LATENCY=1)\n");
+		return;
+	}
+	if (vec >= NVECTORS) {
+		cprintf("No vector %d\n", vec);
+		return;
+	}
+	khz = tsc_khz();
+	cprintf("TSC %lu kHz; latencies in cycles\n", khz);
+	if (vec < 0)
+		cprintf("vec %-22s %8s %8s %8s %8s %8s\n",
+			"", "count", "min", "mean", "p99<=", "max");
+	for (v = vec < 0 ? 0 : vec; v < (vec < 0 ? NVECTORS : vec + 1); v++) {
+		// the handlers keep updating it while we print
+		__asm __volatile("cli");
+		snap = traplat[v];
+		__asm __volatile("sti");
+		tl = &snap;
+		if (tl->tl_count == 0) {
+			if (vec >= 0)
+				cprintf("No traps through vector %d\n", v);
+			continue;
+		}
+		if (vec < 0) {
+			cprintf("%3d %-22s %8u %8u %8u %8u %8u\n", v,
+				trapname(v), tl->tl_count, tl->tl_min,
+				(uint32_t) (tl->tl_sum / tl->tl_count),
+				p99(tl), tl->tl_max);
+			continue;
+		}
+		cprintf("Vector %d (%s): %u traps, mean %u cycles (%u ns)\n",
+			v, trapname(v), tl->tl_count,
+			(uint32_t) (tl->tl_sum / tl->tl_count),
+			khz ? (uint32_t) (tl->tl_sum * 1000000 / khz
+					  / tl->tl_count) : 0);
+		for (b = 0; b < NBUCKETS; b++)
+			if (tl->tl_hist[b])
+				cprintf("  %10u..%10u %10u\n", 1U << b,
+					(2U << b) - 1, tl->tl_hist[b]);
+	}
+}